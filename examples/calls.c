@@ -0,0 +1,47 @@
+// calls.c : calls that -O2 evaluates while compiling and -O3 inlines
+
+int total;
+
+int sq (int x) {
+	return x * x;
+}
+
+int fact (int n) {
+	if (n < 2) return 1;
+	return n * fact(n - 1);
+}
+
+int add (int a, int b) {
+	return a + b;
+}
+
+int count (int v) {
+	// not a pure function : it must run every time
+	total = total + v;
+	return total;
+}
+
+int gcd (int a, int b) {
+	while (b) {
+		a = a % b;
+		if (!a) return b;
+		b = b % a;
+	}
+	return a;
+}
+
+int main () {
+	int i, s;
+
+	printf("%d %d %d\n", sq(12), fact(10), add(sq(3), sq(4)));
+	printf("%d %d\n", gcd(1071, 462), gcd(17, 5));
+	s = 0;
+	i = 0;
+	while (i < 10) {
+		s = add(s, sq(i));
+		count(i);
+		i++;
+	}
+	printf("%d %d %d\n", s, total, count(0));
+	return 0;
+}
@@ -0,0 +1,60 @@
+// loops.c : loops whose invariant code -O2 moves out
+
+int g;
+int tbl[16];
+
+int sum_to (int n) {
+	int i, s;
+	i = 0;
+	s = 0;
+	while (i < n) {
+		s = s + i * g + tbl[3];
+		i++;
+	}
+	return s;
+}
+
+int bump (int n) {
+	// the loop stores to the global it reads
+	int i;
+	i = 0;
+	while (i < n) {
+		g = g + tbl[i & 15];
+		tbl[(i + 1) & 15] = g & 255;
+		i++;
+	}
+	return g;
+}
+
+int nested (int n) {
+	int i, j, s, *p;
+	p = tbl;
+	s = 0;
+	i = 0;
+	while (i < n) {
+		j = 0;
+		while (j < n) {
+			s = s + p[j & 15] * (n - 1) + i;
+			j++;
+		}
+		p[i & 15] = s & 1023;
+		i++;
+	}
+	return s;
+}
+
+int main () {
+	int i;
+
+	i = 0;
+	while (i < 16) {
+		tbl[i] = i * i;
+		i++;
+	}
+	g = 3;
+	printf("%d\n", sum_to(100));
+	printf("%d\n", bump(50));
+	printf("%d\n", sum_to(10));
+	printf("%d\n", nested(20));
+	return 0;
+}
@@ -0,0 +1,31 @@
+// macros.c : the preprocessor, numbers in a function-like macro are never its parameters
+
+#define N 10
+#define SQ(x) ((x) * (x))
+#define ADD1(a) ((a) + 1)
+#define SCALE(a, b) ((a) * 100 + (b) * 2 + 0)
+#define POW2(n) (1 << (n))
+
+#if N > 5
+#define BIG 1
+#else
+#define BIG 0
+#endif
+
+#ifndef ADD1
+#define ADD1(a) 0
+#endif
+
+int main () {
+	int i, s;
+
+	printf("%d %d %d\n", SQ(N), ADD1(41), SCALE(3, 4));
+	s = 0;
+	i = 0;
+	while (i < N) {
+		s = s + POW2(i) + ADD1(i) * 2;
+		i++;
+	}
+	printf("%d %d\n", s, BIG);
+	return 0;
+}
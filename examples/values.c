@@ -0,0 +1,50 @@
+// values.c : loads and stores that value numbering (-O2) must not merge
+
+char c;
+int x;
+char buf[8];
+
+int narrow (int v) {
+	// the store truncates, the reload of v does not
+	c = v;
+	return v;
+}
+
+int twice (int *p) {
+	int a, b;
+	a = *p;
+	*p = a + 1;
+	b = *p;
+	return a + b;
+}
+
+int main () {
+	int i, n, s;
+	char k;
+
+	n = narrow(300);
+	printf("%d %d\n", n, c);
+	x = 41;
+	n = twice(&x);
+	printf("%d %d\n", n, x);
+
+	// a char local through its address and by name
+	k = 200 + 100;
+	printf("%d\n", k + k);
+
+	i = 0;
+	s = 0;
+	while (i < 8) {
+		buf[i] = i * 40;
+		s = s + buf[i] + buf[i];
+		i++;
+	}
+	printf("%d\n", s);
+
+	n = 7;
+	x = n * n;
+	n = x;
+	x = n + 1;
+	printf("%d %d\n", n, x);
+	return 0;
+}
@@ -2,39 +2,115 @@
 #include "stdlib.h"
 #include "memory.h"
 #include "string.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sched.h"
+#include "sys/mman.h"
+#include "sys/wait.h"
+#include "sys/epoll.h"
+#include "sys/socket.h"
+#include "sys/syscall.h"
+#include "pthread.h"
+
+// THREAD : a variable of the compiler, which every thread has its own copy of, see Compiler context.
+// pcc has no thread-local variables, so pcc.c compiled by pcc shares them between its threads.
+#ifdef __GNUC__
+#define THREAD __thread
+#else
+#define THREAD
+#endif
 
 int DEBUG;
 int ASM;
+int LAZY;
+int OPT;
 
-int token; 			// current token
-char *src, *old_src;		// pointer to src string
+THREAD int lazy;		// LAZY as it applies to the compile going on
+
+THREAD int token; 			// current token
+THREAD char *src, *old_src;		// pointer to src string
 int poolsize;			// default size
-int line;			// current line number
+THREAD int line;			// current line number
+
+THREAD int *text, *old_text; 		// text segment, dump text segment
+THREAD char *data;			// data segment
 
-int *text, *old_text, *stack; 	// text segment, dump text segment, stack
-char *data;			// data segment
+// VM context
+// What a running program changes lives in its context rather than in globals : its registers, its
+// stack, its globals (a data segment of its own), its output, its task pool and coroutines. So any
+// number of contexts can run at the same time in eval(), e.g. one per thread. The compiler works in
+// variables of the thread compiling, and the tables a program needs to compile more later are kept
+// with the program (see Compiler context).
+//
+// 			 VM context:
+// ---+--+--+--+--+-----+----+-------+-----+----+-------+----+------+-----+------+-------+---+---
+//  ..|Pc|Bp|Sp|Ax|Cycle|Fuel|Current|Stack|Prog|Globals|Pool|Worker|Coros|Caller|CoState|Out| ..
+// ---+--+--+--+--+-----+----+-------+-----+----+-------+----+------+-----+------+-------+---+---
+//
+// Pc / Bp / Sp / Ax : VM registers, program counter, base pointer, stack pointer (from high addr -> low addr), general-purpose register (GPR)
+// Cycle : number of instructions executed so far
+// Fuel : if not 0, eval() suspends the context after running that many instructions
+// Current : when suspended, the context that was running (the context itself or a coroutine), 0 otherwise
+// Stack : the stack area of the context
+// Prog : the program being run
+// Globals : the data segment of the run, a copy of the one of the program made by pcc_start(),
+//           0 to run on the data segment of the program itself
+// Pool / Worker : the task pool of the program and the number of the thread in it, see spawn() in eval()
+// Coros : the stack pool of the coroutines created by the context, see Coroutines
+// Caller / CoState : for a coroutine, the context that resumed it and its state
+// Out : the output buffer of the context, see Output
+enum {Pc, Bp, Sp, Ax, Cycle, Fuel, Current, Stack, Prog, Globals, Pool, Worker, Coros, Caller, CoState, Out, VmSize};
+
+// Program
+// A compiled program, see pcc_compile() / pcc_run().
+//
+// 			 Program:
+// ---+----+-------+----+-------+-----+-----+-------+-----+-----+------+----+--------+---
+//  ..|Text|TextEnd|Data|DataEnd|Image|Entry|Symbols|Units|Links|Counts|Lock|Compiler| ..
+// ---+----+-------+----+-------+-----+-----+-------+-----+-----+------+----+--------+---
+//
+// Text / Data : text segment / data segment of the program
+// TextEnd : end of the used part of the text segment, lazily compiled functions go there
+// DataEnd : end of the used part of the data segment
+// Image : copy of the data segment right after compiling, every run starts from a copy of it
+// Entry : address of main()
+// Symbols : the symbol table
+// Units : the number of files it was compiled from, Links : their link tables (see Linking)
+// Counts : with pcc -p, the counts of the runs (see Profile-guided optimization), 0 otherwise
+// Lock : 1 while one of its functions is being compiled (see Lazy compilation)
+// Compiler : the tables of the compiler it was compiled with (see Compiler context)
+//
+// Note : the code refers to a global with GLB addr, addr being its address in the data segment of
+// the program, and eval() moves it to the data segment of the run. So runs of the same program can
+// overlap, each one with globals of its own. String literals are never written to, the code refers
+// to them by absolute address with IMM. The data segments are mmap-ed rather than malloc-ed so that
+// they can be shared with the task workers (see spawn() in eval()).
 
-int *pc, *bp, *sp, ax, cycle; 	// VM registers, program counter, base pointer, stack pointer (from high addr -> low addr), general-purpose registers (GPRs)
+enum {Text, TextEnd, Data, DataEnd, Image, Entry, Symbols, Units, Links, Counts, Lock, Compiler, ProgSize};
 
 // Instructions supported (intel x86-based)
 enum { 
-	LEA, IMM, JMP, CALL, JZ, JNZ, ENT, ADJ, LEV, LI, LC, SI, SC, PUSH, 
+	LEA, IMM, GLB, JMP, CALL, JZ, JNZ, JEQ, JNE, JLT, JGT, JLE, JGE, STUB, ENT, LIO, LCO, SIO, SCO, ADJ, LEV, LI, LC, SI, SC, PUSH, CRET, HRET,
 	OR, XOR, AND, EQ, NE, LT, GT, LE, GE, SHL, SHR, ADD, SUB, MUL, DIV, MOD,
-	OPEN, READ, CLOS, PRTF, MALC, MSET, MCMP, EXIT 
+	OPEN, READ, CLOS, PRTF, MALC, FREE, MSET, MCMP, MCPY, MMAP, MUNM, FORK, WAIT, QUIT, FLSH, SCNF, SYLD, USLP,
+	ATAD, ACAS, SPWN, JOIN, COCR, RSME, YELD, CODN, COFR, WRIT, FCNT, PIPE, SKPR, EPCR, EPCT, EPWT, EPWA, EPFD,
+	PRED, PWRT, SYSC, LSEK, IOQC, IOQR, IOQW, IOQS, IOQP, IOQF,
+	SNPR, PUTS, PUTC, OUTW, SOCK, BIND, LSTN, ACPT, DUP2, UNLK, QSRT, BSRC, THCR, THJN, EXIT 
 };
 
 // Tokens and classes supported (last operator has the highest precedence)
 // (e.g. = -> Assign, == -> Eq, != -> Ne)
 // Most of the tokens are understandable, some of them that are not so intuitive are pointed out below :
 // Glo -> Global Variable
+// Def -> Macro
 // Fun -> Function
 // Lan / Lor -> && / ||
 // Brak -> Bracket
 
 enum {
-	Num = 128, Fun, Sys, Glo, Loc, Id,
-	Char, Else, Enum, If, Int, Return, Sizeof, While,
-	Assign, Cond, Lor, Lan, Or, Xor, And, Eq, Ne, Lt, Gt, Le, Ge, Shl, Shr, Add, Sub, Mul, Div, Mod, Inc, Dec, Brak
+	Num = 128, Fun, Sys, Glo, Loc, Def, Id,
+	Char, Else, Enum, Extern, If, Int, Return, Sizeof, Struct, While,
+	Assign, Cond, Lor, Lan, Or, Xor, And, Eq, Ne, Lt, Gt, Le, Ge, Shl, Shr, Add, Sub, Mul, Div, Mod, Inc, Dec, Brak, Dot, Arrow
 };
 
 
@@ -42,10 +118,10 @@ enum {
 // It's basically a list of keywords / stuff we have at the moment, each of them is called an identifier for a variable / a keyword / a number.
 //
 // 			 Symbol table:
-// ----+-----+----+----+----+-----+-----+-----+------+------+----
-//  .. |Token|Hash|Name|Type|Class|Value|BType|BClass|BValue| ..
-// ----+-----+----+----+----+-----+-----+-----+------+------+----
-//     |<---            one single identifier           --->|
+// ----+-----+----+----+----+-----+-----+----+-----+------+------+-----+----
+//  .. |Token|Hash|Name|Type|Class|Value|Size|BType|BClass|BValue|BSize| ..
+// ----+-----+----+----+----+-----+-----+----+-----+------+------+-----+----
+//     |<---                  one single identifier                 --->|
 // 
 // Token : the return mark of an identifer, we also include keywords if, while and etc. and give them a unique token
 // Hash : the hash of an identifier used for comparision of identifiers
@@ -53,14 +129,15 @@ enum {
 // Class : the class of identifier, (e.g. Local / Global / Number)
 // Type : the type of identifier (Int, Char, Pointer ...)
 // Value : the value of the identifer, if the identifier is a function, value is the address of the function
-// BType / BClass / BValue : when a local identifier is identical with a global identifer, put global identifier in BType / BClass / BValue.
+// Size : for an array, the size in bytes of its elements, the identifier then stands for their address; 0 otherwise
+// BType / BClass / BValue / BSize : when a local identifier is identical with a global identifer, put global identifier in BType / BClass / BValue / BSize.
 
 
-int token_val; 			// value of current token
-int *current_id, *symbols;	// current parsed ID, the Symbol Table above
+THREAD int token_val; 			// value of current token
+THREAD int *current_id, *symbols;	// current parsed ID, the Symbol Table above
 
-// Since we don't support struct, we use enum as an array instead.
-enum {Token, Hash, Name, Type, Class, Value, BType, BClass, BValue, IdSize};
+// The compiler itself does not use struct, we use enum as an array instead.
+enum {Token, Hash, Name, Type, Class, Value, Size, BType, BClass, BValue, BSize, IdSize};
 
 // Keywords
 // Keywords like if, while, else, return are not normal identifiers, they have certain meanings.
@@ -69,23 +146,715 @@ enum {Token, Hash, Name, Type, Class, Value, BType, BClass, BValue, IdSize};
 // 2. We predefine a symbol table with keywords and essential information of what they do.
 // In pcc, we use option 2.
 
-int *idmain;
+THREAD int *idmain;
 
 // types of variable / function supported
-enum { CHAR, INT, PTR };
+// A struct type is INT + 1 + its number in the struct table (see Structs), so every base type is
+// below PTR and a pointer adds PTR per level, e.g. struct 0 ** is INT + 1 + 2 * PTR.
+enum { CHAR, INT, PTR = 256 };
 
-int basetype, expr_type;	// basetype : type of declartion of variable / function / type
+THREAD int basetype, expr_type;	// basetype : type of declartion of variable / function / type
 				// Note : for type declaration, only enum is supported in pcc
 				// expr_type : type of an expression
 
-int index_of_bp;		// index of base pointer on the stack
+THREAD int index_of_bp;		// index of base pointer on the stack
+
+THREAD int *cmp_at;			// position of the comparison at the root of the last expression, 0 if none
+THREAD int *member_at;			// position of the last load with offset (LIO / LCO), 0 if none
+THREAD int expr_resume;		// set when expression() should continue after an already compiled operand
+
+// Compile errors
+// fail() reports a compile error and sets failed. From then on next() only returns the end of the
+// source, match() and expression() return at once and the loops of the parser end on it, so the
+// compiler unwinds to its caller, which releases what it built. Only the first error is printed.
+
+THREAD int failed;			// a compile error was reported
+
+void fail (char *fmt, int a, int b) {
+	// report the compile error printf(fmt, a, b), unless there was one already
+	if (!failed) printf(fmt, a, b);
+	failed = 1;
+	token = 0;
+}
+
+// Preprocessor
+// next() hands the lines starting with # to pp_directive(), which supports :
+//
+//    #include "file"		the file is read in place of the line, looked up next to the file
+//    			including it, then in the current directory ; <file> and files that are
+//    			not found are left out, the library of pcc is built in
+//    #define id body		an object-like macro
+//    #define id(a, b) body	a function-like macro, # and ## are not supported
+//    #undef id
+//    #if expr / #ifdef id / #ifndef id / #elif expr / #else / #endif
+//    #pragma once
+//
+// A macro is a symbol of class Def whose Value points right after its name in the source. When
+// next() reads it, the body with the arguments in place of the parameters is written to the
+// expansion buffer and read from there until its end, where reading goes back to the source.
+// Included files work the same way, both are kept on a stack :
+//
+// 		Source stack:
+// +---+---+----+-----+----+---+
+// |Src|Old|Line|Macro|File|Top|
+// +---+---+----+-----+----+---+
+//
+// Src / Old / Line : src, old_src and line to go back to
+// Macro : the macro expanded, it is not expanded again inside its expansion ; 0 for a file
+// File : the file included ; 0 for a macro
+// Top : where its expansion starts in the expansion buffer, which is freed when it ends
+//
+// The identifiers of a body or of arguments get their symbols before they are copied, so the
+// name of a symbol never points into the expansion buffer.
+//
+// Files are read once per program and kept with what is known about them :
+//
+// 		File:
+// +----+----+---+-----+----+----+
+// |Name|Text|Len|Guard|Once|Seen|
+// +----+----+---+-----+----+----+
+//
+// Len : the size of the file
+// Guard : the name of the macro if the file is all in #ifndef NAME / #define NAME ... #endif
+// Once : the file has #pragma once
+// Seen : the file was included
+//
+// A file that is guarded by a macro already defined, or has #pragma once and was included, is
+// left out without reading it again. Only the mapped text is kept, a file included again is lexed
+// again, and the processes of pcc -m each read and lex their headers.
+
+enum {PpSrc, PpOld, PpLine, PpMacro, PpFile, PpTop, PpSize};
+enum {FileName, FileText, FileLen, FileGuard, FileOnce, FileSeen, FileSize};
+enum {MaxNest = 64, MaxFiles = 256, MaxParams = 16, PathSize = 256};
+
+THREAD int *pp_stack, pp_len;		// the source stack, its depth
+THREAD char *pp_buf, *pp_out;		// the expansion buffer, where the expansion being written goes
+THREAD int pp_top;			// first free byte of the expansion buffer
+THREAD int *pp_files, pp_files_len;	// the files read so far
+THREAD char *pp_main;			// path of the main source file, 0 if unknown
+
+char *map_file (int fd, int size) {
+	// map a file read only with a 0 right after its last byte, without copying it :
+	// reserve size + 1 zeroed bytes, then map the file over the start of them
+	char *p;
+
+	if ( (p = mmap(0, size + 1, 1, 0x22, -1, 0)) == (char *)-1 ) return 0;
+	if ( mmap(p, size, 1, 0x12, fd, 0) != p ) {
+		munmap(p, size + 1);
+		return 0;
+	}
+	return p;
+}
+
+int is_name (int c) {
+	// can c be part of an identifier
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c == '_');
+}
+
+int *identifier () {
+	// the symbol of the identifier at src, a new one if there is none yet, src goes past it
+	char *last_pos;
+	int hash;
+	int *id;
+
+	last_pos = src;
+	hash = *src++;
+	while (is_name(*src)) {
+		hash = hash * 147 + *src;
+		src++;
+	}
+
+	// search for identifer to see if there is already one
+	// The following is a linear search, could be optimised
+	id = symbols;
+	while (id[Token]) {
+		if ( (id[Hash] == hash) && (!memcmp( (char *)id[Name], last_pos, src - last_pos) ) ) return id;
+		id = id + IdSize;
+	}
+
+	// Not found, store a new id
+	id[Name] = (int)last_pos;
+	id[Hash] = hash;
+	id[Token] = Id;
+	return id;
+}
+
+void pp_space () {
+	while ( (*src == ' ') || (*src == '\t') ) src++;
+}
+
+void pp_eol () {
+	while (*src && (*src != '\n')) src++;
+}
+
+int pp_word () {
+	// length of the word at src, src goes past it
+	char *p;
+
+	p = src;
+	while (is_name(*src)) src++;
+	return src - p;
+}
+
+int *pp_id () {
+	// the symbol of the identifier at src
+	pp_space();
+	if ( !( (*src >= 'a' && *src <= 'z') || (*src >= 'A' && *src <= 'Z') || (*src == '_') ) ) {
+		fail("ERROR : identifier expected in directive at line %d\n", line, 0);
+		return 0;
+	}
+	return identifier();
+}
+
+char *pp_literal (char *p) {
+	// past the string / char literal at p
+	int q;
+
+	q = *p++;
+	while (*p && (*p != q) && (*p != '\n')) {
+		if ( (*p == '\\') && p[1] ) p++;
+		p++;
+	}
+	if (*p == q) p++;
+	return p;
+}
+
+void pp_register (char *p, char *end) {
+	// give a symbol to the identifiers in [p, end)
+	char *old;
+
+	old = src;
+	src = p;
+	while (src < end) {
+		if ( (*src == '"') || (*src == '\'') ) src = pp_literal(src);
+		else if (*src >= '0' && *src <= '9') pp_word();
+		else if (is_name(*src)) identifier();
+		else src++;
+	}
+	src = old;
+}
+
+char *pp_body_end (char *p) {
+	// the end of the body at p, lines ending with \ go on
+	while (*p && (*p != '\n')) {
+		if ( (*p == '\\') && (p[1] == '\n') ) p++;
+		p++;
+	}
+	return p;
+}
+
+int *pp_file () {
+	// the file being read, 0 for the main one
+	int i;
+
+	i = pp_len;
+	while (i-- > 0) {
+		if (pp_stack[i * PpSize + PpFile]) return (int *)pp_stack[i * PpSize + PpFile];
+	}
+	return 0;
+}
+
+void pp_push (char *text, int *macro, int *file) {
+	// read text now, then go on with the current source
+	int *r;
+
+	if ( !pp_stack && !(pp_stack = malloc(MaxNest * PpSize * sizeof(int))) ) {
+		fail("ERROR : could not malloc source stack\n", 0, 0);
+		return;
+	}
+	if (pp_len >= MaxNest) {
+		fail("ERROR : macros / includes nested too deep at line %d\n", line, 0);
+		return;
+	}
+	r = pp_stack + pp_len++ * PpSize;
+	r[PpSrc] = (int)src;
+	r[PpOld] = (int)old_src;
+	r[PpLine] = line;
+	r[PpMacro] = (int)macro;
+	r[PpFile] = (int)file;
+	r[PpTop] = pp_top;
+	src = old_src = text;
+}
+
+int pp_pop () {
+	// at the end of an expansion / included file, go back to where it was used, returns the next char
+	int *r;
+
+	while (!*src && pp_len) {
+		r = pp_stack + --pp_len * PpSize;
+		src = (char *)r[PpSrc];
+		old_src = (char *)r[PpOld];
+		pp_top = r[PpTop];
+		if (r[PpFile]) line = r[PpLine];
+	}
+	return *src;
+}
+
+void pp_emit (char *p, int n) {
+	// append n bytes to the expansion being written
+	if (pp_out + n >= pp_buf + poolsize) {
+		fail("ERROR : macro expansion too large at line %d\n", line, 0);
+		return;
+	}
+	memcpy(pp_out, p, n);
+	pp_out = pp_out + n;
+}
+
+int pp_expand (int *id) {
+	// write the expansion of the macro id and read it next, 0 if it is not expanded here
+	int par_at[MaxParams], par_len[MaxParams], arg_at[MaxParams], arg_len[MaxParams];
+	int np, na, i, depth;
+	char *body, *end, *p, *q;
+
+	// not inside its own expansion
+	i = 0;
+	while (i < pp_len) {
+		if (pp_stack[i++ * PpSize + PpMacro] == (int)id) return 0;
+	}
+
+	body = (char *)id[Value];
+	np = na = 0;
+	if (*body == '(') {
+		// function-like, only a call expands it
+		p = src;
+		while ( (*p == ' ') || (*p == '\t') ) p++;
+		if (*p != '(') return 0;
+
+		// the parameters
+		p = body + 1;
+		while ( (*p == ' ') || (*p == '\t') ) p++;
+		while (*p != ')') {
+			if ( (np >= MaxParams) || !is_name(*p) ) {
+				fail("ERROR : invalid macro parameters at line %d\n", line, 0);
+				return 0;
+			}
+			par_at[np] = (int)p;
+			while (is_name(*p)) p++;
+			par_len[np] = p - (char *)par_at[np];
+			np++;
+			while ( (*p == ' ') || (*p == '\t') || (*p == ',') ) p++;
+		}
+		body = p + 1;
+
+		// the arguments, split at the commas outside parentheses
+		p = src;
+		while (*p != '(') p++;
+		q = ++p;
+		depth = 0;
+		while (*p && ( depth || (*p != ')') )) {
+			if ( (*p == '"') || (*p == '\'') ) p = pp_literal(p);
+			else {
+				if (*p == '(') depth++;
+				else if (*p == ')') depth--;
+				else if ( (*p == ',') && !depth ) {
+					if (na < MaxParams) {
+						arg_at[na] = (int)q;
+						arg_len[na] = p - q;
+					}
+					na++;
+					q = p + 1;
+				}
+				p++;
+			}
+		}
+		if (!*p) {
+			fail("ERROR : unterminated macro call at line %d\n", line, 0);
+			return 0;
+		}
+		while ( (q < p) && ( (*q == ' ') || (*q == '\t') ) ) q++;
+		if ( na || (q < p) ) {
+			if (na < MaxParams) {
+				arg_at[na] = (int)q;
+				arg_len[na] = p - q;
+			}
+			na++;
+		}
+		if (na != np) {
+			fail("ERROR : wrong number of macro arguments at line %d\n", line, 0);
+			return 0;
+		}
+		pp_register(src, p);
+		src = p + 1;
+	}
+
+	// the body, parameters replaced by the arguments
+	if ( !pp_buf && !(pp_buf = malloc(poolsize)) ) {
+		fail("ERROR : could not malloc expansion buffer\n", 0, 0);
+		return 0;
+	}
+	pp_out = pp_buf + pp_top;
+	end = pp_body_end(body);
+	p = body;
+	while (p < end) {
+		if ( (*p == '\\') && (p[1] == '\n') ) {
+			pp_emit(" ", 1);
+			p = p + 2;
+		} else if ( (*p == '"') || (*p == '\'') ) {
+			q = pp_literal(p);
+			pp_emit(p, q - p);
+			p = q;
+		} else if (is_name(*p)) {
+			q = p;
+			while (is_name(*p)) p++;
+			i = (*q >= '0' && *q <= '9') ? np : 0;	// a number is never a parameter
+			while ( (i < np) && ( (par_len[i] != p - q) || memcmp((char *)par_at[i], q, p - q) ) ) i++;
+			if (i < np) pp_emit( (char *)arg_at[i], arg_len[i] );
+			else pp_emit(q, p - q);
+		} else pp_emit(p++, 1);
+	}
+	pp_emit("", 1);
+	if (failed) return 0;
+
+	pp_push(pp_buf + pp_top, id, 0);
+	pp_top = pp_out - pp_buf;
+	return 1;
+}
+
+void pp_define () {
+	// #define id body / #define id(a, b) body
+	int *id;
+	char *p;
+
+	if ( !(id = pp_id()) ) return;
+	if ( (id[Token] != Id) || ( id[Class] && (id[Class] != Def) ) ) {
+		fail("ERROR : invalid macro name at line %d\n", line, 0);
+		return;
+	}
+	id[Class] = Def;
+	id[Value] = (int)src;
+
+	p = pp_body_end(src);
+	pp_register(src, p);
+	while (src < p) {
+		if (*src++ == '\n') line++;
+	}
+}
+
+int pp_binop () {
+	// the binary operator at src as a token, 0 if there is none
+	int c, d;
+
+	pp_space();
+	c = *src;
+	d = src[1];
+	if (c == '|') return (d == '|') ? Lor : Or;
+	if (c == '&') return (d == '&') ? Lan : And;
+	if (c == '^') return Xor;
+	if (c == '=') return (d == '=') ? Eq : 0;
+	if (c == '!') return (d == '=') ? Ne : 0;
+	if (c == '<') {
+		if (d == '=') return Le;
+		return (d == '<') ? Shl : Lt;
+	}
+	if (c == '>') {
+		if (d == '=') return Ge;
+		return (d == '>') ? Shr : Gt;
+	}
+	if (c == '+') return Add;
+	if (c == '-') return Sub;
+	if (c == '*') return Mul;
+	if (c == '/') return (d == '/') ? 0 : Div;
+	if (c == '%') return Mod;
+	return 0;
+}
+
+int pp_expr (int level) {
+	// the value of the #if expression at src, with the precedence of expression()
+	// a unit is a number, defined(id), a macro (the value of its body), ( expr ) or ! / - unit ;
+	// anything else is 0
+	int *id;
+	int v, r, op, base;
+	char *p;
+
+	pp_space();
+	v = 0;
+	if (*src == '(') {
+		src++;
+		v = pp_expr(Lor);
+		pp_space();
+		if (*src == ')') src++;
+	} else if (*src == '!') {
+		src++;
+		v = !pp_expr(Inc);
+	} else if (*src == '-') {
+		src++;
+		v = -pp_expr(Inc);
+	} else if (*src >= '0' && *src <= '9') {
+		if ( (*src == '0') && ( (src[1] == 'x') || (src[1] == 'X') ) ) {
+			src = src + 2;
+			while ( (*src >= '0' && *src <= '9') || (*src >= 'a' && *src <= 'f') || (*src >= 'A' && *src <= 'F') ) {
+				v = v * 16 + (*src & 15) + (*src >= 'A' ? 9 : 0);
+				src++;
+			}
+		} else {
+			base = (*src == '0') ? 8 : 10;
+			while (*src >= '0' && *src <= '9') v = v * base + *src++ - '0';
+		}
+		pp_word();	// suffixes, e.g. 1L
+	} else if (is_name(*src)) {
+		p = src;
+		id = identifier();
+		if ( (src - p == 7) && !memcmp(p, "defined", 7) ) {
+			pp_space();
+			v = (*src == '(');
+			if (v) src++;
+			id = pp_id();
+			pp_space();
+			if ( v && (*src == ')') ) src++;
+			v = id && (id[Class] == Def);
+		} else if ( (id[Class] == Def) && (*(char *)id[Value] != '(') ) {
+			p = src;
+			src = (char *)id[Value];
+			v = pp_expr(Lor);
+			src = p;
+		}
+	}
+
+	while ( (op = pp_binop()) && (op >= level) ) {
+		src = src + ( ( (op == Lor) || (op == Lan) || (op == Eq) || (op == Ne) || (op == Le) || (op == Ge) || (op == Shl) || (op == Shr) ) ? 2 : 1 );
+		if 	(op == Lor) r = pp_expr(Lan);
+		else if (op == Lan) r = pp_expr(Or);
+		else if (op <= And) r = pp_expr(op + 1);
+		else if (op <= Ne) r = pp_expr(Lt);
+		else if (op <= Ge) r = pp_expr(Shl);
+		else if (op <= Shr) r = pp_expr(Add);
+		else if (op <= Sub) r = pp_expr(Mul);
+		else r = pp_expr(Inc);
+
+		if 	(op == Lor) v = v || r;
+		else if (op == Lan) v = v && r;
+		else if (op == Or) v = v | r;
+		else if (op == Xor) v = v ^ r;
+		else if (op == And) v = v & r;
+		else if (op == Eq) v = v == r;
+		else if (op == Ne) v = v != r;
+		else if (op == Lt) v = v < r;
+		else if (op == Gt) v = v > r;
+		else if (op == Le) v = v <= r;
+		else if (op == Ge) v = v >= r;
+		else if (op == Shl) v = v << r;
+		else if (op == Shr) v = v >> r;
+		else if (op == Add) v = v + r;
+		else if (op == Sub) v = v - r;
+		else if (op == Mul) v = v * r;
+		else if (op == Div) v = r ? v / r : 0;
+		else v = r ? v % r : 0;
+	}
+	return v;
+}
+
+void pp_skip (int take) {
+	// skip the lines of a group up to its #endif, with take up to its #else / an #elif that holds
+	char *p;
+	int depth, n;
+
+	depth = 0;
+	while (*src) {
+		pp_eol();
+		if (*src) {
+			src++;
+			line++;
+		}
+		pp_space();
+		if (*src == '#') {
+			src++;
+			pp_space();
+			p = src;
+			n = pp_word();
+			if ( (n >= 2) && !memcmp(p, "if", 2) ) depth++;
+			else if ( (n == 5) && !memcmp(p, "endif", 5) ) {
+				if (!depth--) return;
+			} else if ( take && !depth && (n == 4) && !memcmp(p, "else", 4) ) return;
+			else if ( take && !depth && (n == 4) && !memcmp(p, "elif", 4) && pp_expr(Lor) ) return;
+		}
+	}
+}
+
+void pp_blank () {
+	// skip white space and comments, for pp_guard()
+	while ( (*src == ' ') || (*src == '\t') || (*src == '\n') || (*src == '\r') || ( (*src == '/') && (src[1] == '/') ) ) {
+		if (*src == '/') pp_eol();
+		else src++;
+	}
+}
+
+char *pp_guard (char *text) {
+	// the name of the macro guarding text, 0 if it is not all in #ifndef NAME / #define NAME ... #endif
+	char *old, *name, *p;
+	int depth, n;
+
+	old = src;
+	src = text;
+	name = 0;
+	pp_blank();
+	if (*src == '#') {
+		src++;
+		pp_space();
+		p = src;
+		if ( (pp_word() == 6) && !memcmp(p, "ifndef", 6) ) {
+			pp_space();
+			name = src;
+			n = pp_word();
+			pp_eol();
+			pp_blank();
+			p = 0;
+			if (*src == '#') {
+				src++;
+				pp_space();
+				p = src;
+				if ( (pp_word() == 6) && !memcmp(p, "define", 6) ) {
+					pp_space();
+					p = src;
+					if ( (pp_word() != n) || memcmp(p, name, n) ) p = 0;
+				} else p = 0;
+			}
+
+			// the #endif of the #ifndef ends the file
+			depth = 1;
+			while (p && *src && depth) {
+				pp_eol();
+				if (*src) src++;
+				pp_space();
+				if (*src == '#') {
+					src++;
+					pp_space();
+					p = src;
+					n = pp_word();
+					if ( (n >= 2) && !memcmp(p, "if", 2) ) depth++;
+					else if ( (n == 5) && !memcmp(p, "endif", 5) ) depth--;
+				}
+			}
+			pp_eol();
+			pp_blank();
+			if ( !p || depth || *src ) name = 0;
+		}
+	}
+	src = old;
+	return name;
+}
+
+int *pp_load (char *path) {
+	// the file at path, read if it has not been yet, 0 if there is none
+	int *f;
+	int i, fd, size;
+
+	if ( !pp_files && !(pp_files = malloc(MaxFiles * FileSize * sizeof(int))) ) {
+		fail("ERROR : could not malloc file table\n", 0, 0);
+		return 0;
+	}
+	size = 0;
+	while (path[size]) size++;
+	i = 0;
+	while (i < pp_files_len) {
+		f = pp_files + i++ * FileSize;
+		if (!memcmp( (char *)f[FileName], path, size + 1 )) return f;
+	}
+
+	if (pp_files_len >= MaxFiles) {
+		fail("ERROR : too many included files\n", 0, 0);
+		return 0;
+	}
+	if ( (fd = open(path, 0)) < 0 ) return 0;
+	f = pp_files + pp_files_len * FileSize;
+	if ( ( (i = lseek(fd, 0, 2)) <= 0 ) || !(f[FileText] = (int)map_file(fd, i)) || !(f[FileName] = (int)malloc(size + 1)) ) {
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	memcpy( (char *)f[FileName], path, size + 1 );
+	f[FileLen] = i;
+	f[FileGuard] = (int)pp_guard( (char *)f[FileText] );
+	f[FileOnce] = 0;
+	f[FileSeen] = 0;
+	pp_files_len++;
+	return f;
+}
+
+void pp_include () {
+	// #include "file"
+	char path[PathSize];
+	char *name, *dir, *old;
+	int len, n, *f, *id;
+
+	pp_space();
+	if (*src != '"') {
+		pp_eol();
+		return;
+	}
+	name = ++src;
+	while (*src && (*src != '"') && (*src != '\n')) src++;
+	len = src - name;
+	pp_eol();
+
+	// next to the file including it first
+	f = pp_file();
+	dir = f ? (char *)f[FileName] : pp_main;
+	n = 0;
+	if (dir) {
+		while (dir[n]) n++;
+		while ( (n > 0) && (dir[n - 1] != '/') ) n--;
+	}
+	if (n + len >= PathSize) {
+		fail("ERROR : include path too long at line %d\n", line, 0);
+		return;
+	}
+	memcpy(path, dir, n);
+	memcpy(path + n, name, len);
+	path[n + len] = 0;
+	if ( !(f = pp_load(path)) && n ) f = pp_load(path + n);
+	if (!f) return;
+
+	if ( f[FileOnce] && f[FileSeen] ) return;
+	if (f[FileGuard]) {
+		old = src;
+		src = (char *)f[FileGuard];
+		id = identifier();
+		src = old;
+		if (id[Class] == Def) return;
+	}
+	f[FileSeen] = 1;
+	pp_push( (char *)f[FileText], 0, f );
+	line = 1;
+}
+
+void pp_directive () {
+	// the directive at src, after its #, up to the end of its line
+	char *p;
+	int n, *id;
+
+	pp_space();
+	p = src;
+	n = pp_word();
+	if ( (n == 7) && !memcmp(p, "include", 7) ) pp_include();
+	else {
+		if ( (n == 6) && !memcmp(p, "define", 6) ) pp_define();
+		else if ( (n == 5) && !memcmp(p, "undef", 5) ) {
+			if ( (id = pp_id()) && (id[Class] == Def) ) id[Class] = 0;
+		} else if ( (n == 5) && !memcmp(p, "ifdef", 5) ) {
+			if ( (id = pp_id()) && (id[Class] != Def) ) pp_skip(1);
+		} else if ( (n == 6) && !memcmp(p, "ifndef", 6) ) {
+			if ( (id = pp_id()) && (id[Class] == Def) ) pp_skip(1);
+		} else if ( (n == 2) && !memcmp(p, "if", 2) ) {
+			if (!pp_expr(Lor)) pp_skip(1);
+		} else if ( (n == 4) && ( !memcmp(p, "else", 4) || !memcmp(p, "elif", 4) ) ) {
+			// the group that was taken ends here
+			pp_skip(0);
+		} else if ( (n == 6) && !memcmp(p, "pragma", 6) ) {
+			pp_space();
+			p = src;
+			if ( (pp_word() == 4) && !memcmp(p, "once", 4) && (id = pp_file()) ) id[FileOnce] = 1;
+		}
+		pp_eol();
+	}
+}
 
 // Lexical Analyser
 void next () {
 	char *last_pos;
-	int hash;
 	
-	while ( (token = *src) ) {
+	// the end of a macro expansion / an included file goes back to where it was used,
+	// after a compile error the source has ended
+	while ( !failed && ( (token = *src) || (token = pp_pop()) ) ) {
 	// We have 2 options when encourted unknown char
 	// 1. Point out the ERROR and Quit the whole interpreter
 	// 2. Point out the ERROR and Go on
@@ -98,48 +867,30 @@ void next () {
 				old_src = src;
 
 				while (old_text < text) {
-					printf("%8.4s", & 	"LEA ,IMM ,JMP ,CALL,JZ  ,JNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PUSH,"
+					printf("%8.4s", & 	"LEA ,IMM ,GLB ,JMP ,CALL,JZ  ,JNZ ,JEQ ,JNE ,JLT ,JGT ,JLE ,JGE ,STUB,ENT ,LIO ,LCO ,SIO ,SCO ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PUSH,CRET,HRET,"
                                       				"OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,"
-                                      				"OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,EXIT" [*++old_text * 5] );
+                                      				"OPEN,READ,CLOS,PRTF,MALC,FREE,MSET,MCMP,MCPY,MMAP,MUNM,FORK,WAIT,QUIT,FLSH,SCNF,SYLD,USLP,"
+                                      				"ATAD,ACAS,SPWN,JOIN,COCR,RSME,YELD,CODN,COFR,WRIT,FCNT,PIPE,SKPR,EPCR,EPCT,EPWT,EPWA,EPFD,"
+						"PRED,PWRT,SYSC,LSEK,IOQC,IOQR,IOQW,IOQS,IOQP,IOQF,"
+						"SNPR,PUTS,PUTC,OUTW,SOCK,BIND,LSTN,ACPT,DUP2,UNLK,QSRT,BSRC,THCR,THJN,EXIT" [*++old_text * 5] );
 
 					if (*old_text <= ADJ) printf("%d\n", *++old_text);
 					else printf("\n");
 				}
 			}
 			line++;
-		} else if (token == '#')
-				// pcc does not support macros at this stage
-				while ( (*src != 0) && (*src !='\n') ) src++;
+		} else if (token == '#') pp_directive();
 
 		// Identifier	
 		else if ( (token >= 'a' && token <= 'z') || (token >= 'A' && token <= 'Z') || (token == '_')) {
-			
-			// parse identifier
-			last_pos = src - 1;
-			hash = token;
-			while ( (*src >= 'a' && *src <= 'z') || (*src >= 'A' && *src <= 'Z') || (*src >= '0' && *src <= '9') || (*src == '_')) {
-				hash = hash * 147 + *src;
-				src++;
-			}
-			
-			// search for identifer to see if there is already one
-			// The following is a linear search, could be optimised
-			current_id = symbols;
-			while (current_id[Token]) {
-				if ( (current_id[Hash] == hash) && (!memcmp( (char *)current_id[Name], last_pos, src - last_pos) ) ) {
-					// there is one exsisting identifier already
-					token = current_id[Token];
-					return;
-				}
-				// Otherwise go on with the search
-				current_id = current_id + IdSize;
-			}
+			src--;
+			current_id = identifier();
 
-			// Not found, store a new id
-			current_id[Name] = (int)last_pos;
-			current_id[Hash] = hash;
-			token = current_id[Token] = Id;
-			return;
+			// a macro is replaced by its expansion, which is read next
+			if ( (current_id[Class] != Def) || !pp_expand(current_id) ) {
+				token = current_id[Token];
+				return;
+			}
 		}
 
 		// Number
@@ -231,11 +982,15 @@ void next () {
 		
 		// -
 		// -- Decrease by 1
+		// -> Member through a pointer
 		// - Substraction
 		else if (token == '-') {
 			if (*src == '-') {
 				src++;
 				token = Dec;
+			} else if (*src == '>') {
+				src++;
+				token = Arrow;
 			} else token = Sub;
 			return;
 		}
@@ -318,6 +1073,10 @@ void next () {
 			token = Brak;
 			return;
 		}
+		else if (token == '.') {
+			token = Dot;
+			return;
+		}
 		else if (token == '?') {
 			token = Cond;
 			return;
@@ -327,97 +1086,592 @@ void next () {
 			return;
 
 	}
+	token = 0;
 	return;
 }
 
 
 void match(int tk) {
+	if (failed) return;
 	if (token == tk) next();
 	else {
-		printf("ERROR : expected token %d at line %d\n", tk, line);
-		exit(-1);
+		fail("ERROR : expected token %d at line %d\n", tk, line);
+		return;
 	}
 }
 
 
-void expression (int level) {
-	// We use Reverse Polish Notation RPN for determing the precedence of calculation
-	// For further information : Dijkstra's Shunting Yard Algorithm (https://blog.wudaiqi.com/2018/12/07/SPOJ-ONP-Transform-the-Expression/)
-	//
-	// Example :
-	// 3 + 4 * 2 / ( 1 - 5 ) ^ 2
-	//
-	// | Token | Action                  | Output                | Stack   | Notes                        |
-	// |-------|-------------------------|-----------------------|---------|------------------------------|
-	// | 3     | output                  | 3                     |         |                              |
-	// | +     | push to stack           | 3                     | +       |                              |
-	// | 4     | output                  | 3 4                   | +       |                              |
-	// | *     | push to stack and check | 3 4                   | * +     | * has higher precedence      |
-	// | 2     | output                  | 3 4 2                 | * +     |                              |
-	// | /     | pop from stack          | 3 4 2 *               | +       | / and * have same precedence |
-	// |       | push to stack           | 3 4 2 *               | / +     | / has higher precedence      |
-	// | (     | push to stack           | 3 4 2 *               | ( / +   |                              |
-	// | 1     | output                  | 3 4 2 * 1             | ( / +   |                              |
-	// | -     | push to stack           | 3 4 2 * 1             | - ( / + |                              |
-	// | 5     | output                  | 3 4 2 * 1 5           | - ( / + |                              |
-	// | )     | pop from stack until (  | 3 4 2 * 1 5 -         | ( / +   | ) right bracket found        |
-	// |       | pop (                   | 3 4 2 * 1 5 -         | / +     | ( is not needed anymore      |
-	// | ^     | push to stack           | 3 4 2 * 1 5 -         | ^ / +   |                              |
-	// | 2     | output                  | 3 4 2 * 1 5 - 2       | ^ / +   |                              |
-	// |       | pop until stack empty   | 3 4 2 * 1 5 - 2 ^ / + |         |                              |
-	//
-	// We deal with two types of expressions
-	// 1. unit_unary ::= unit | unit unary_op | unary_op unit
-	// 2. expr ::= unit_unary (bin_op unit_unary ...)
-	
-	int *id, *addr;
-	int tmp;
-	
-	// deal with unexpected token
-	if (!token) {
-		printf("ERROR : unexpected token at the end of expression at line %d\n", line);
-		exit(-1);
-	}
-
-	if 		(token == Num) {
-		match(Num);
+// String literals
+// next() copies a string literal to the data segment as it reads it, then the parser interns it :
+// if the same text, or a text ending with it, is already there, the copy is dropped and the
+// literal is the earlier one. Literals are chained in buckets by the hash of their bytes like
+// identifiers, and by the hash of their last TailLen bytes (or all of them) to find the longer
+// ones a literal ends, each literal once per length up to TailLen.
+//
+// 	String : |At|Len|Hash|Next|	At : where it is in the data segment, Len : its length
+// 					Next : the literal before it in its bucket + 1, 0 for none
+// 	Tail : |Str|Next|		Str : the literal, Next : the tail before it in its bucket + 1
+//
+// Note : a literal may then share its bytes with others, so it must not be written to.
+
+enum {StrAt, StrLen, StrHash, StrNext, StrSize};
+enum {TailStr, TailNext, TailSize};
+enum {StrBuckets = 1024, TailLen = 4};
+
+THREAD int *strs, str_len;		// literals of the data segment, their number
+THREAD int *tails, tail_len;		// endings of the literals, their number
+THREAD int *str_heads;			// the last literal + 1 of each bucket of hashes, then the last tail + 1 of each bucket of endings
+THREAD int str_data;			// the data segment they are in
+
+void str_reset (int seg) {
+	// forget the literals, the next ones go to the data segment seg
+	str_len = tail_len = 0;
+	str_data = seg;
+	if (str_heads) memset(str_heads, 0, 2 * StrBuckets * sizeof(int));
+}
 
-		*++text = IMM;
-		*++text = token_val;
-		expr_type = INT;
+int str_tail (char *s, int len, int n) {
+	// the bucket of endings for the last n bytes of s, len long
+	int hash, i;
+	hash = 0;
+	i = 1;
+	while (i <= n) hash = hash * 147 + s[len - i++];
+	return StrBuckets + ( (hash * 31 + n) & (StrBuckets - 1) );
+}
 
-	} else if 	(token == '"') {
-		// Note : pcc supports string in the following format
-		// char *p;
-		// p = 	"first line"
-		// 	"second line";
-		//
-		// It is equivalent to 
-		// char *p
-		// p = 	"first linesecond line";
-		
-		*++text = IMM;
-		*++text = token_val;
+char *str_intern (char *s) {
+	// the literal from s to data, just read, returns its address and moves data past it
+	int *e, *t;
+	int len, hash, i;
 
-		match('"');
-		while (token == '"') match('"');
+	len = data - s;
+	hash = 0;
+	i = 0;
+	while (i < len) hash = hash * 147 + s[i++];
 
-		data = (char *)( ( (int)data + sizeof(int) ) & ( -sizeof(int) ) );
+	if (!strs) {
+		if ( !(strs = malloc(poolsize)) || !(tails = malloc(poolsize)) || !(str_heads = malloc(2 * StrBuckets * sizeof(int))) ) {
+			fail("ERROR : could not malloc string table\n", 0, 0);
+			return s;
+		}
+		memset(str_heads, 0, 2 * StrBuckets * sizeof(int));
+	}
 
-		expr_type = PTR;
+	i = str_heads[hash & (StrBuckets - 1)];
+	while (i) {
+		e = strs + (i - 1) * StrSize;
+		if ( (e[StrHash] == hash) && (e[StrLen] == len) && !memcmp( (char *)e[StrAt], s, len ) ) {
+			memset(s, 0, len);
+			data = s;
+			return (char *)e[StrAt];
+		}
+		i = e[StrNext];
+	}
 
-	} else if	(token == Sizeof) {
-		// Note : sizeof is an unary operator
-		// pcc only supports sizeof(int), sizeof(char), sizeof(pointer)
-		
-		match(Sizeof);
-		match('(');
-		expr_type = INT;
+	// a suffix of a longer one, e.g. "line\n" in "at line\n"
+	i = len ? str_heads[str_tail(s, len, (len < TailLen) ? len : TailLen)] : 0;
+	while (i) {
+		t = tails + (i - 1) * TailSize;
+		e = strs + t[TailStr] * StrSize;
+		if ( (e[StrLen] > len) && !memcmp( (char *)e[StrAt] + e[StrLen] - len, s, len ) ) {
+			memset(s, 0, len);
+			data = s;
+			return (char *)e[StrAt] + e[StrLen] - len;
+		}
+		i = t[TailNext];
+	}
+
+	if ( (str_len + 1) * StrSize * sizeof(int) <= poolsize ) {
+		e = strs + str_len * StrSize;
+		e[StrAt] = (int)s;
+		e[StrLen] = len;
+		e[StrHash] = hash;
+		e[StrNext] = str_heads[hash & (StrBuckets - 1)];
+		str_heads[hash & (StrBuckets - 1)] = ++str_len;
+		i = 1;
+		while ( (i <= len) && (i <= TailLen) && ( (tail_len + 1) * TailSize * sizeof(int) <= poolsize ) ) {
+			t = tails + tail_len * TailSize;
+			t[TailStr] = str_len - 1;
+			hash = str_tail(s, len, i++);
+			t[TailNext] = str_heads[hash];
+			str_heads[hash] = ++tail_len;
+		}
+	}
+	data = (char *)( ( (int)data + sizeof(int) ) & ( -sizeof(int) ) );
+	return s;
+}
+
+// Linking
+// A function or a global can be used before it is defined, or without being defined in the file
+// at all (see Separate compiling) : a prototype, an extern declaration or a call to an unknown
+// function gives the symbol a link record, and the address of the record stands for the symbol
+// in the code until it is known.
+//
+// 	Link record : |Addr|Hash|Name|Def|	Addr : the address of the symbol, 0 while unknown
+// 						Name : a copy of the name, Def : 1 if the file defines it
+//
+// Each file has a link table, its records go up from the head and their names down from the end :
+//
+// +----+-------+----+-------+----+-----+---+-----+------------+--    --+-------+
+// |Text|TextEnd|Cold|ColdEnd|Data|Entry|Len|Names| records -> |        | <- names
+// +----+-------+----+-------+----+-----+---+-----+------------+--    --+-------+
+//
+// Text / TextEnd, Cold / ColdEnd : where the code of the file is, Data : the end of its globals
+// Entry : its main(), 0 if none, Len : the number of records, Names : the last name
+//
+// A definition fills in the Addr of the record it had, if any. Linking fills in the Addr of the
+// others from the records the files define, then replaces the address of a record in the code
+// with its Addr where it is the operand of a CALL or a GLB, whose operands can be nothing else than
+// addresses : the code is read op by op for that (an op up to ADJ has an operand), and pcc never
+// adds an offset to the address of a global at compile time, so the addresses stay whole. The
+// operand of an IMM may be any number, so the address of a function that is not defined yet is
+// read from its record when the program runs, IMM record, LI, and IMM is never patched.
+
+enum {LtText, LtTextEnd, LtCold, LtColdEnd, LtData, LtEntry, LtLen, LtNames, LtHead};
+enum {LnkAddr, LnkHash, LnkName, LnkDef, LnkSize};
+
+THREAD int *links;			// link table of the file being compiled
+THREAD int link_lo, link_hi;		// where the link tables of the program are
+
+int is_link (int a) {
+	// is a the address of a link record
+	return (a >= link_lo) && (a < link_hi);
+}
+
+int *link_add (int *id, int addr, int def) {
+	// a new record for the symbol id
+	int *r;
+	char *s, *name;
+	int n;
+
+	name = (char *)id[Name];
+	n = 0;
+	while (is_name(name[n])) n++;
+	r = links + LtHead + links[LtLen] * LnkSize;
+	s = (char *)links[LtNames] - n - 1;
+	if ( (char *)(r + LnkSize) > s ) {
+		fail("ERROR : too many symbols to link at line %d\n", line, 0);
+		return links + LtHead;
+	}
+	memcpy(s, name, n);
+	s[n] = 0;
+	links[LtNames] = (int)s;
+	links[LtLen]++;
+	r[LnkAddr] = addr;
+	r[LnkHash] = id[Hash];
+	r[LnkName] = (int)s;
+	r[LnkDef] = def;
+	return r;
+}
+
+int link_ref (int *id) {
+	// the address standing for the symbol id until it is defined
+	return (int)link_add(id, 0, 0);
+}
+
+void link_defs (int *id) {
+	// records for the functions and globals of the symbol table id the file defines
+	while (id[Token]) {
+		if ( ( (id[Class] == Fun) || (id[Class] == Glo) ) && !is_link(id[Value]) ) link_add(id, id[Value], 1);
+		id = id + IdSize;
+	}
+}
+
+int *link_find (int *table, int n, int *r) {
+	// the record defining the symbol of r in the n link tables from table, 0 if there is none
+	int *d;
+	int i;
+	char *a, *b;
+
+	while (n--) {
+		d = table + LtHead;
+		i = table[LtLen];
+		while (i--) {
+			if ( d[LnkDef] && (d[LnkHash] == r[LnkHash]) ) {
+				a = (char *)d[LnkName];
+				b = (char *)r[LnkName];
+				while (*a && (*a == *b)) {
+					a++;
+					b++;
+				}
+				if (*a == *b) return d;
+			}
+			d = d + LnkSize;
+		}
+		table = table + poolsize / sizeof(int);
+	}
+	return 0;
+}
+
+int link_code (int *pc, int *end) {
+	// replace the addresses of records called / used as globals in the code [pc, end) with the
+	// addresses they stand for, 0 if one is still unknown
+	int op;
+	int *r;
+
+	while (pc < end) {
+		op = *pc++;
+		if (op <= ADJ) {
+			if ( ( (op == CALL) || (op == GLB) ) && is_link(*pc) ) {
+				r = (int *)*pc;
+				if (!r[LnkAddr]) {
+					printf("ERROR : undefined symbol %s\n", (char *)r[LnkName]);
+					return 0;
+				}
+				*pc = r[LnkAddr];
+			}
+			pc = pc + ( (op == STUB) ? 3 : 1 );	// a stub is |STUB|id|src|line|
+		}
+	}
+	return 1;
+}
+
+int *link_unknown (int *pc, int *end) {
+	// the first record called / used as a global in the code [pc, end) whose Addr is still 0, 0 if none
+	int op;
+	int *r;
+
+	while (pc < end) {
+		op = *pc++;
+		if (op <= ADJ) {
+			if ( ( (op == CALL) || (op == GLB) ) && is_link(*pc) ) {
+				r = (int *)*pc;
+				if (!r[LnkAddr]) return r;
+			}
+			pc = pc + ( (op == STUB) ? 3 : 1 );
+		}
+	}
+	return 0;
+}
+
+int link_all (int *table, int n) {
+	// link the n files whose link tables are one after the other from table, 0 on error
+	int *t, *r, *d;
+	int k, i;
+
+	k = 0;
+	while (k < n) {
+		t = table + k * (poolsize / sizeof(int));
+		r = t + LtHead;
+		i = t[LtLen];
+		while (i--) {
+			if ( r[LnkDef] && link_find(t + poolsize / sizeof(int), n - k - 1, r) ) {
+				printf("ERROR : %s is defined in more than one file\n", (char *)r[LnkName]);
+				return 0;
+			}
+			if ( !r[LnkAddr] && (d = link_find(table, n, r)) ) r[LnkAddr] = d[LnkAddr];
+			r = r + LnkSize;
+		}
+		k++;
+	}
+
+	k = 0;
+	while (k < n) {
+		t = table + k * (poolsize / sizeof(int));
+		if ( !link_code( (int *)t[LtText], (int *)t[LtTextEnd] ) || !link_code( (int *)t[LtCold], (int *)t[LtColdEnd] ) ) return 0;
+		k++;
+	}
+	return 1;
+}
+
+// Structs
+// Each struct tag gets a record in the struct table the first time it is named, so that a pointer
+// to a struct can be declared before its body (e.g. struct node *next inside struct node), and
+// its fields go to the field table when the body is parsed.
+//
+// 	Struct : |Tag|Bytes|		Field : |Struct|Tag|Type|Offset|Array|
+//
+// Tag : the identifier naming the struct / field
+// Bytes : size of the struct, 0 until its body is known
+// Struct : the type of the struct the field belongs to
+// Offset : bytes from the start of the struct to the field
+// Array : for an array field, its size in bytes, the field then stands for its address; 0 otherwise
+//
+// Fields other than char are aligned to sizeof(int) and the size of a struct is rounded up to it.
+// A field is loaded / stored with its offset as the operand of a single instruction, and the
+// offsets of nested fields add up at compile time :
+//
+//    p->y = q.in.x + 1        LEA 2, LI, PUSH, LEA -4, LIO 12, PUSH, IMM 1, ADD, SIO 4
+//
+// where p is a parameter, q a local of 16 bytes, y is at offset 4 in *p, in at offset 8 in q and
+// x at offset 4 in q.in.
+
+enum {StTag, StBytes, StSize};
+enum {FldStruct, FldTag, FldType, FldOffset, FldArray, FldSize};
+enum {MaxFields = 4096};
+
+THREAD int *structs, struct_len;	// the struct table, number of structs in it
+THREAD int *fields, field_len;		// the field table, number of fields in it
+
+int type_size (int type) {
+	// bytes taken by a value of type, 0 for a struct whose body is not known yet
+	if (type == CHAR) return sizeof(char);
+	if ( (type > INT) && (type < PTR) ) return structs[(type - INT - 1) * StSize + StBytes];
+	return sizeof(int);
+}
+
+int type_step (int type) {
+	// bytes from one element to the next for a pointer of type, 1 for anything else
+	int step;
+
+	if (type < PTR) return 1;
+	if ( !(step = type_size(type - PTR)) ) {
+		fail("ERROR : incomplete struct at line %d\n", line, 0);
+		return 1;
+	}
+	return step;
+}
+
+void index_scale (int type) {
+	// scale the index in ax by the elements a pointer of type points to
+	int step;
+
+	if ( (step = type_step(type)) > 1 ) {
+		*++text = PUSH;
+		*++text = IMM;
+		*++text = step;
+		*++text = MUL;
+	}
+}
+
+int struct_type () {
+	// struct id : the type of the struct, recorded if it is named for the first time
+	int i;
+
+	match(Struct);
+	if (token != Id) {
+		fail("ERROR : invalid struct name at line %d\n", line, 0);
+		return INT;
+	}
+	if ( !structs && ( !(structs = malloc( (PTR - INT - 1) * StSize * sizeof(int) )) || !(fields = malloc(MaxFields * FldSize * sizeof(int))) ) ) {
+		fail("ERROR : could not malloc struct table\n", 0, 0);
+		return INT;
+	}
+
+	i = 0;
+	while ( (i < struct_len) && (structs[i * StSize + StTag] != (int)current_id) ) i++;
+	if (i == struct_len) {
+		if (INT + 1 + i >= PTR) {
+			fail("ERROR : too many structs at line %d\n", line, 0);
+			return INT;
+		}
+		structs[i * StSize + StTag] = (int)current_id;
+		structs[i * StSize + StBytes] = 0;
+		struct_len++;
+	}
+	match(Id);
+	return INT + 1 + i;
+}
+
+int *field_find (int type, int *id) {
+	// the field id of the struct type, 0 if there is none
+	int *f;
+	int i;
+
+	i = 0;
+	while (i < field_len) {
+		f = fields + i++ * FldSize;
+		if ( (f[FldStruct] == type) && (f[FldTag] == (int)id) ) return f;
+	}
+	return 0;
+}
+
+int array_size (int open) {
+	// [ n ] : the number of elements, n being a number or an enum constant
+	// open : [] is allowed too and gives 0
+	int n;
+
+	match(Brak);
+	if ( open && (token == ']') ) {
+		match(']');
+		return 0;
+	}
+	n = token_val;
+	if ( (token == Id) && (current_id[Class] == Num) ) n = current_id[Value];
+	else if (token != Num) n = 0;
+	if (n <= 0) {
+		fail("ERROR : invalid array size at line %d\n", line, 0);
+		return 1;
+	}
+	match(token);
+	match(']');
+	return n;
+}
+
+void struct_declaration (int st) {
+	// parse the fields of struct id { type {'*'} field ['[' n ']'] [, ...]; ... }
+	int base, type, n, bytes, size;
+	int *f;
+
+	if (type_size(st)) {
+		fail("ERROR : duplicate struct declaration at line %d\n", line, 0);
+		return;
+	}
+
+	size = 0;
+	while ( token && (token != '}') ) {
+		base = INT;
+		if (token == Int) match(Int);
+		else if (token == Char) {
+			match(Char);
+			base = CHAR;
+		} else if (token == Struct) base = struct_type();
+		else {
+			fail("ERROR : invalid field declaration at line %d\n", line, 0);
+			return;
+		}
+
+		while ( token && (token != ';') ) {
+			type = base;
+			while (token == Mul) {
+				match(Mul);
+				type = type + PTR;
+			}
+			if ( (token != Id) || field_find(st, current_id) ) {
+				fail("ERROR : invalid field declaration at line %d\n", line, 0);
+				return;
+			}
+			if (field_len >= MaxFields) {
+				fail("ERROR : too many fields at line %d\n", line, 0);
+				return;
+			}
+			f = fields + field_len++ * FldSize;
+			f[FldStruct] = st;
+			f[FldTag] = (int)current_id;
+			match(Id);
+
+			n = (token == Brak) ? array_size(0) : 0;
+			if ( !(bytes = type_size(type)) ) {
+				fail("ERROR : incomplete struct at line %d\n", line, 0);
+				return;
+			}
+			if (type != CHAR) size = (size + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+			f[FldType] = n ? type + PTR : type;
+			f[FldOffset] = size;
+			f[FldArray] = n * bytes;
+			size = size + (n ? n * bytes : bytes);
+
+			if (token == ',') match(',');
+		}
+		match(';');
+	}
+
+	if (!size) {
+		fail("ERROR : empty struct at line %d\n", line, 0);
+		return;
+	}
+	structs[(st - INT - 1) * StSize + StBytes] = (size + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+}
+
+void member_unfold () {
+	// turn a last LIO / LCO offset back into PUSH, IMM offset, ADD, LI / LC, for the code that
+	// needs the address of the field
+	int op, off;
+
+	if ( member_at && (member_at + 1 == text) ) {
+		op = *member_at;
+		off = *text;
+		text = member_at - 1;
+		*++text = PUSH;
+		*++text = IMM;
+		*++text = off;
+		*++text = ADD;
+		*++text = (op == LCO) ? LC : LI;
+		member_at = 0;
+	}
+}
+
+void expression (int level) {
+	// We use Reverse Polish Notation RPN for determing the precedence of calculation
+	// For further information : Dijkstra's Shunting Yard Algorithm (https://blog.wudaiqi.com/2018/12/07/SPOJ-ONP-Transform-the-Expression/)
+	//
+	// Example :
+	// 3 + 4 * 2 / ( 1 - 5 ) ^ 2
+	//
+	// | Token | Action                  | Output                | Stack   | Notes                        |
+	// |-------|-------------------------|-----------------------|---------|------------------------------|
+	// | 3     | output                  | 3                     |         |                              |
+	// | +     | push to stack           | 3                     | +       |                              |
+	// | 4     | output                  | 3 4                   | +       |                              |
+	// | *     | push to stack and check | 3 4                   | * +     | * has higher precedence      |
+	// | 2     | output                  | 3 4 2                 | * +     |                              |
+	// | /     | pop from stack          | 3 4 2 *               | +       | / and * have same precedence |
+	// |       | push to stack           | 3 4 2 *               | / +     | / has higher precedence      |
+	// | (     | push to stack           | 3 4 2 *               | ( / +   |                              |
+	// | 1     | output                  | 3 4 2 * 1             | ( / +   |                              |
+	// | -     | push to stack           | 3 4 2 * 1             | - ( / + |                              |
+	// | 5     | output                  | 3 4 2 * 1 5           | - ( / + |                              |
+	// | )     | pop from stack until (  | 3 4 2 * 1 5 -         | ( / +   | ) right bracket found        |
+	// |       | pop (                   | 3 4 2 * 1 5 -         | / +     | ( is not needed anymore      |
+	// | ^     | push to stack           | 3 4 2 * 1 5 -         | ^ / +   |                              |
+	// | 2     | output                  | 3 4 2 * 1 5 - 2       | ^ / +   |                              |
+	// |       | pop until stack empty   | 3 4 2 * 1 5 - 2 ^ / + |         |                              |
+	//
+	// We deal with two types of expressions
+	// 1. unit_unary ::= unit | unit unary_op | unary_op unit
+	// 2. expr ::= unit_unary (bin_op unit_unary ...)
+	
+	int *id, *addr;
+	int tmp, off;
+	
+	// unwind after a compile error, see fail()
+	if (failed) return;
+
+	// deal with unexpected token
+	if (!token) {
+		fail("ERROR : unexpected token at the end of expression at line %d\n", line, 0);
+		return;
+	}
+
+	if		(expr_resume) {
+		// the left operand has already been compiled by condition(), go on with the operators
+		expr_resume = 0;
+
+	} else if 	(token == Num) {
+		match(Num);
+
+		*++text = IMM;
+		*++text = token_val;
+		expr_type = INT;
+
+	} else if 	(token == '"') {
+		// Note : pcc supports string in the following format
+		// char *p;
+		// p = 	"first line"
+		// 	"second line";
+		//
+		// It is equivalent to 
+		// char *p
+		// p = 	"first linesecond line";
+		
+		addr = (int *)token_val;
+		match('"');
+		while (token == '"') match('"');
+
+		*++text = IMM;
+		*++text = (int)str_intern( (char *)addr );
+
+		expr_type = PTR;
+
+	} else if	(token == Sizeof) {
+		// Note : sizeof is an unary operator
+		// pcc only supports sizeof(int), sizeof(char), sizeof(struct id), sizeof(pointer) and sizeof(variable)
+		
+		match(Sizeof);
+		match('(');
+		expr_type = INT;
+		tmp = 0;
 
 		if (token == Int) match(Int);
 		else if (token == Char) {
 			match(Char);
 			expr_type = CHAR;
+		} else if (token == Struct) expr_type = struct_type();
+		else if ( (token == Id) && ( (current_id[Class] == Loc) || (current_id[Class] == Glo) ) ) {
+			// sizeof(variable), all of it for an array
+			expr_type = current_id[Type];
+			tmp = current_id[Size];
+			match(Id);
 		}
 
 		while (token == Mul) {
@@ -427,8 +1681,16 @@ void expression (int level) {
 
 		match(')');
 
+		if (tmp < 0) {
+			fail("ERROR : size of extern array unknown at line %d\n", line, 0);
+			return;
+		}
+		if ( !tmp && !(tmp = type_size(expr_type)) ) {
+			fail("ERROR : incomplete struct at line %d\n", line, 0);
+			return;
+		}
 		*++text = IMM;
-		*++text = (expr_type == CHAR) ? sizeof(char) : sizeof(int);
+		*++text = tmp;
 
 		expr_type = INT;
 
@@ -450,7 +1712,7 @@ void expression (int level) {
 			// arguments
 			
 			tmp = 0;
-			while (token != ')') {
+			while ( token && (token != ')') ) {
 				expression(Assign);
 				*++text = PUSH;
 				tmp++;
@@ -463,13 +1725,18 @@ void expression (int level) {
 			if (id[Class] == Sys) 
 				// System Functions
 				*++text = id[Value];
-			else if (id[Class] == Fun) {
-				// Normal Functions
+			else if ( (id[Class] == Fun) || !id[Class] ) {
+				// Normal Functions, an unknown one returns an int and is defined later, see Linking
+				if (!id[Class]) {
+					id[Class] = Fun;
+					id[Type] = INT;
+					id[Value] = link_ref(id);
+				}
 				*++text = CALL;
 				*++text = id[Value];
 			} else {
-				printf("ERROR : invalid function call at line %d\n", line);
-				exit(-1);
+				fail("ERROR : invalid function call at line %d\n", line, 0);
+				return;
 			}
 
 			if (tmp > 0) {
@@ -478,6 +1745,12 @@ void expression (int level) {
 			}
 			expr_type = id[Type];
 
+		} else if (id[Class] == Fun) {
+			// the address of a function, e.g. spawn(fn, arg), from its link record if it has one
+			*++text = IMM;
+			*++text = id[Value];
+			if (is_link(id[Value])) *++text = LI;
+			expr_type = INT;
 		} else if (id[Class] == Num) {
 			// enum variable
 			*++text = IMM;
@@ -488,23 +1761,27 @@ void expression (int level) {
 				*++text = LEA;
 				*++text = index_of_bp - id[Value];
 			} else if (id[Class] == Glo) {
-				*++text = IMM;
+				*++text = GLB;
 				*++text = id[Value];
 			} else {
-				printf("ERROR : undefined variable at line %d\n", line);
-				exit(-1);
+				fail("ERROR : undefined variable at line %d\n", line, 0);
+				return;
 			}
 
 			expr_type = id[Type];
-			*++text = (expr_type == Char) ? LC : LI;
+			// an array is the address of its elements, nothing to load
+			if (!id[Size]) *++text = (expr_type == Char) ? LC : LI;
 		}
 
 	} else if 	(token == '(') {
 		match('(');
 
-		if ( (token == Int) || (token == Char) ) {
-			tmp = (token == Char) ? CHAR : INT;
-			match(token);
+		if ( (token == Int) || (token == Char) || (token == Struct) ) {
+			if (token == Struct) tmp = struct_type();
+			else {
+				tmp = (token == Char) ? CHAR : INT;
+				match(token);
+			}
 			while (token == Mul) {
 				match(Mul);
 				tmp = tmp + PTR;
@@ -525,18 +1802,19 @@ void expression (int level) {
 
 		if (expr_type >= PTR) expr_type = expr_type - PTR;
 		else {
-			printf("ERROR : invalid dereference at line %d\n", line);
-			exit(-1);
+			fail("ERROR : invalid dereference at line %d\n", line, 0);
+			return;
 		}
 
 		*++text = (expr_type == CHAR) ? LC : LI;
 	} else if 	(token == And) {
 		match(And);
 		expression(Inc);
+		member_unfold();
 		if ( (*text == LC) || (*text == LI) ) text--;
 		else {
-			printf("ERROR : invalid address at line %d\n", line);
-			exit(-1);
+			fail("ERROR : invalid address at line %d\n", line, 0);
+			return;
 		}
 
 		expr_type = expr_type + PTR;
@@ -549,6 +1827,7 @@ void expression (int level) {
 		*++text = IMM;
 		*++text = 0;
 		*++text = EQ;
+		cmp_at = text;
 
 		expr_type = INT;
 
@@ -602,6 +1881,7 @@ void expression (int level) {
 		expression(Inc);
 		
 		// when dealing with ++a, we use variable a twice, so we use PUSH first.
+		member_unfold();
 		if (*text == LC) {
 			*text = PUSH;
 			*++text = LC;
@@ -609,21 +1889,21 @@ void expression (int level) {
 			*text = PUSH;
 			*++text = LI;
 		} else {
-			printf("ERROR : invalid value for pre-increment at line %d\n", line);
-			exit(-1);
+			fail("ERROR : invalid value for pre-increment at line %d\n", line, 0);
+			return;
 		}
 
 		*++text = PUSH;
 		*++text = IMM;
 		
 		// pre-increment also works with pointers
-		*++text = (expr_type > PTR) ? sizeof(int) : sizeof(char);
+		*++text = type_step(expr_type);
 		*++text = (tmp == Inc) ? ADD : SUB;
 		*++text = (expr_type == CHAR) ? SC : SI;
 
 	} else {
-		printf("ERROR : invalid expression at line %d\n", line);
-		exit(-1);
+		fail("ERROR : invalid expression at line %d\n", line, 0);
+		return;
 	}
 
 	// binary operators and postfix operators
@@ -634,16 +1914,31 @@ void expression (int level) {
 			// a = b;
 			match(Assign);
 
-			if ( (*text == LC) || (*text == LI) ) *text = PUSH;
+			if ( (tmp > INT) && (tmp < PTR) ) {
+				fail("ERROR : struct assignment not supported at line %d\n", line, 0);
+				return;
+			}
+
+			off = 0;
+			if ( member_at && (member_at + 1 == text) ) {
+				// s.x = v : store with the offset of x
+				off = *text;
+				text = member_at;
+				*text = PUSH;
+				member_at = 0;
+			} else if ( (*text == LC) || (*text == LI) ) *text = PUSH;
 			else {
-				printf("ERROR : invalid value at assignment at line %d\n", line);
-				exit(-1);
+				fail("ERROR : invalid value at assignment at line %d\n", line, 0);
+				return;
 			}
 
 			expression(Assign);
 			
 			expr_type = tmp;
-			*++text = (expr_type == CHAR) ? SC : SI;
+			if (off) {
+				*++text = (expr_type == CHAR) ? SCO : SIO;
+				*++text = off;
+			} else *++text = (expr_type == CHAR) ? SC : SI;
 		
 		} else if 	(token == Cond) {
 			// a = <statement> ? b : c
@@ -653,8 +1948,8 @@ void expression (int level) {
 			expression(Assign);
 
 			if (token == ':') match(':'); else {
-				printf("ERROR : missing : in conditional statement at line %d\n", line);
-				exit(-1);
+				fail("ERROR : missing : in conditional statement at line %d\n", line, 0);
+				return;
 			}
 
 			*addr = (int)(text + 3);
@@ -662,6 +1957,7 @@ void expression (int level) {
 			addr = ++text;
 			expression(Cond);
 			*addr = (int)(text + 1);
+			cmp_at = 0; // something jumps right behind the last operand
 
 		} else if 	(token == Lor) {
 			// a || b		  a && b
@@ -679,6 +1975,7 @@ void expression (int level) {
 			expression(Lan);
 			
 			*addr = (int)(text + 1);
+			cmp_at = 0;
 			expr_type = INT;
 
 		} else if 	(token == Lan) {
@@ -689,6 +1986,7 @@ void expression (int level) {
 			addr = ++text;
 			expression(Or);
 			*addr = (int)(text + 1);
+			cmp_at = 0;
 			expr_type = INT;
 
 		} else if 	(token == Or) {
@@ -724,12 +2022,7 @@ void expression (int level) {
 			expression(Mul);
 
 			expr_type = tmp;
-			if (expr_type > PTR) {
-				*++text = PUSH;
-				*++text = IMM;
-				*++text = sizeof(int);
-				*++text = MUL;
-			}
+			index_scale(expr_type);
 			*++text = ADD;
 
 		} else if 	(token == Sub) {
@@ -737,18 +2030,17 @@ void expression (int level) {
 			*++text = PUSH;
 			expression(Mul);
 
-			if ( (tmp > PTR) && (tmp == expr_type) ) {
+			if ( (tmp >= PTR) && (tmp == expr_type) ) {
 				*++text = SUB;
-				*++text = PUSH;
-				*++text = IMM;
-				*++text = sizeof(int);
-				*++text = DIV;
+				if ( (off = type_step(tmp)) > 1 ) {
+					*++text = PUSH;
+					*++text = IMM;
+					*++text = off;
+					*++text = DIV;
+				}
 				expr_type = INT;
-			} else if (tmp > PTR) {
-				*++text = PUSH;
-				*++text = IMM;
-				*++text = sizeof(int);
-				*++text = MUL;
+			} else if (tmp >= PTR) {
+				index_scale(tmp);
 				*++text = SUB;
 				expr_type = tmp;
 			} else {
@@ -779,36 +2071,42 @@ void expression (int level) {
 			*++text = PUSH;
 			expression(Ne);
 			*++text = EQ;
+			cmp_at = text;
 			expr_type = INT;
 		} else if	(token == Ne) {
 			match(Ne);
 			*++text = PUSH;
 			expression(Lt);
 			*++text = NE;
+			cmp_at = text;
 			expr_type = INT;
 		} else if 	(token == Lt) {
 			match(Lt);
 			*++text = PUSH;
 			expression(Shl);
 			*++text = LT;
+			cmp_at = text;
 			expr_type = INT;
 		} else if	(token == Gt) {
 			match(Gt);
 			*++text = PUSH;
 			expression(Shl);
 			*++text = GT;
+			cmp_at = text;
 			expr_type = INT;
 		} else if 	(token == Le) {
 			match(Le);
 			*++text = PUSH;
 			expression(Shl);
 			*++text = LE;
+			cmp_at = text;
 			expr_type = INT;
 		} else if 	(token == Ge) {
 			match(Ge);
 			*++text = PUSH;
 			expression(Shl);
 			*++text = GE;
+			cmp_at = text;
 			expr_type = INT;
 		} else if 	(token == Shl) {
 			match(Shl);
@@ -825,6 +2123,7 @@ void expression (int level) {
 		} else if 	( (token == Inc) || (token == Dec) ) {
 			// postfix ++ / --
 			
+			member_unfold();
 			if (*text == LC) {
 				*text = PUSH;
 				*++text = LC;
@@ -832,18 +2131,18 @@ void expression (int level) {
 				*text = PUSH;
 				*++text = LI;
 			} else {
-				printf("ERROR : invalid value in increment at line %d\n", line);
-				exit(-1);
+				fail("ERROR : invalid value in increment at line %d\n", line, 0);
+				return;
 			}
 
 			*++text = PUSH;
 			*++text = IMM;
-			*++text = (expr_type > PTR) ? sizeof(int) : sizeof(char);
+			*++text = type_step(expr_type);
 			*++text = (token == Inc) ? ADD : SUB;
 			*++text = (expr_type == CHAR) ? SC : SI;
 			*++text = PUSH;
 			*++text = IMM;
-			*++text = (expr_type > PTR) ? sizeof(int) : sizeof(char);
+			*++text = type_step(expr_type);
 			*++text = (token == Inc) ? SUB : ADD;
 			match(token);
 		
@@ -853,33 +2152,168 @@ void expression (int level) {
 			expression(Assign);
 			match(']');
 
-			if (tmp > PTR) {
-				*++text = PUSH;
-				*++text = IMM;
-				*++text = sizeof(int);
-				*++text = MUL;
-			} else if (tmp < PTR) {
-				printf("ERROR : pointer type array expected at line %d\n", line);
-				exit(-1);
+			if (tmp < PTR) {
+				fail("ERROR : pointer type array expected at line %d\n", line, 0);
+				return;
 			}
+			index_scale(tmp);
 
 			expr_type = tmp - PTR;
 			*++text = ADD;
 			*++text = (expr_type == CHAR) ? LC : LI;
+
+		} else if 	( (token == Dot) || (token == Arrow) ) {
+			// s.x / p->x : the field x at its offset from the address of s / from p, see Structs
+			off = 0;
+			if (token == Arrow) tmp = tmp - PTR;
+			else if ( member_at && (member_at + 1 == text) ) {
+				// s is itself a field, add up the offsets
+				off = *text;
+				text = member_at - 1;
+				member_at = 0;
+			} else if ( (*text == LC) || (*text == LI) ) text--;	// the address of s, not its value
+			else tmp = INT;
+
+			if ( (tmp <= INT) || (tmp >= PTR) ) {
+				fail("ERROR : invalid member access at line %d\n", line, 0);
+				return;
+			}
+			match(token);
+			if ( (token != Id) || !(addr = field_find(tmp, current_id)) ) {
+				fail("ERROR : unknown field at line %d\n", line, 0);
+				return;
+			}
+			match(Id);
+
+			off = off + addr[FldOffset];
+			expr_type = addr[FldType];
+			if (addr[FldArray]) {
+				// an array field is the address of its elements
+				if (off) {
+					*++text = PUSH;
+					*++text = IMM;
+					*++text = off;
+					*++text = ADD;
+				}
+			} else if (off) {
+				*++text = (expr_type == CHAR) ? LCO : LIO;
+				member_at = text;
+				*++text = off;
+			} else *++text = (expr_type == CHAR) ? LC : LI;
+
 		} else {
-			printf("ERROR : compile error, token %d unrecognised at line %d\n", token, line);
-			exit(-1);
+			fail("ERROR : compile error, token %d unrecognised at line %d\n", token, line);
+			return;
 		}
 	}
 }
 
-void statement () {
-	// there are 6 kinds of statements here:
-	// 1. if (...) <statement> [else <statement>]
-	// 2. while (...) <statement>
-	// 3. { <statement> }
-	// 4. return xxx;
-	// 5. <empty statement>;
+// Conditions
+// The condition of an if / while is only ever tested, so instead of computing 0 / 1 in ax and
+// testing it with JZ, pcc compiles it straight into jumps :
+// 1. a comparison at the root of the condition is fused with the jump testing it
+//
+//    <a> PUSH <b> LT JZ x       ->     <a> PUSH <b> JGE x
+//
+// 2. && / || chains jump directly to the body / past the body instead of to the next JZ
+//
+//    while (a < b && c != d)           <a> PUSH <b> JGE x
+//                                      <c> PUSH <d> JEQ x
+//
+// Jumps whose target is not known yet are kept in a backpatch list : the operand of each jump
+// holds the address of the operand of the next jump in the list, 0 ends the list.
+
+int *branch (int *list, int sense) {
+	// emit a jump taken when the value just compiled is true (sense = 1) / false (sense = 0),
+	// add it to list and return the new list
+	int op;
+
+	op = *text;
+	if ( (text == cmp_at) && (op >= EQ) && (op <= GE) ) {
+		if (!sense) {
+			// jump when the comparison fails
+			if 	(op == EQ) op = NE;
+			else if (op == NE) op = EQ;
+			else if (op == LT) op = GE;
+			else if (op == GE) op = LT;
+			else if (op == GT) op = LE;
+			else 		   op = GT;
+		}
+		// JEQ ... JGE are in the same order as EQ ... GE
+		*text = op - EQ + JEQ;
+	} else *++text = sense ? JNZ : JZ;
+
+	*++text = (int)list;
+	cmp_at = 0;
+	return text;
+}
+
+void patch (int *list, int *addr) {
+	// point every jump in list to addr
+	int *next;
+	while (list) {
+		next = (int *)*list;
+		*list = (int)addr;
+		list = next;
+	}
+}
+
+int *condition () {
+	// condition ::= unit { ('&&' | '||') unit }
+	//
+	// The code falls through when the condition holds, the returned list contains the jumps
+	// taken when it does not.
+	int *t, *f;			// jumps to the body / jumps past the body
+
+	t = 0;
+	f = 0;
+	expression(Or);
+	while ( (token == Lan) || (token == Lor) ) {
+		if (token == Lan) f = branch(f, 0);
+		else {
+			// a || b : a false means b decides, so everything that failed so far goes to b
+			t = branch(t, 1);
+			patch(f, text + 1);
+			f = 0;
+		}
+		match(token);
+		expression(Or);
+	}
+
+	if ( (token == Cond) || (token == Assign) ) {
+		// the condition is not a plain chain, e.g. if (c = *p) or if (a && b ? c : d)
+		if (t || f) {
+			// the value of the chain is needed after all
+			f = branch(f, 0);
+			patch(t, text + 1);
+			*++text = IMM;
+			*++text = 1;
+			*++text = JMP;
+			t = ++text;
+			patch(f, text + 1);
+			*++text = IMM;
+			*++text = 0;
+			*t = (int)(text + 1);
+			t = 0;
+			f = 0;
+			expr_type = INT;
+		}
+		expr_resume = 1;
+		expression(Assign);
+	}
+
+	f = branch(f, 0);
+	patch(t, text + 1);
+	return f;
+}
+
+void statement () {
+	// there are 6 kinds of statements here:
+	// 1. if (...) <statement> [else <statement>]
+	// 2. while (...) <statement>
+	// 3. { <statement> }
+	// 4. return xxx;
+	// 5. <empty statement>;
 	// 6. expression; (expression end with semicolon)
 	
 	int *a, *b;
@@ -888,8 +2322,7 @@ void statement () {
 
 		// if (...) <statement> [else <statement>]
 		//
-		//   if (...)           <cond>
-		//                      JZ a
+		//   if (...)           <cond>          <- jumps to a when false, see condition()
 		//     <statement>      <statement>
 		//   else:              JMP b
 		// a:                 a:
@@ -898,29 +2331,26 @@ void statement () {
 
 		match(If);
 		match('(');
-		expression(Assign); // parse condition
+		b = condition();
 		match(')');
 
-		*++text = JZ;
-		b = ++text;
-		
 		statement();
 		if (token == Else) {
 			match(Else);
 
-			*b = (int)(text + 3);
 			*++text = JMP;
-			b = ++text;
+			*++text = 0;
+			patch(b, text + 1);
+			b = text;
 
 			statement();
 		}
 
-		*b = (int)(text + 1);
+		patch(b, text + 1);
 	} else if (token == While) {   
 
 	        // a:                     a:
-		//    while (<cond>)        <cond>
-		//                          JZ b
+		//    while (<cond>)        <cond>          <- jumps to b when false
 		//     <statement>          <statement>
 		//                          JMP a
 		// b:                     b:
@@ -929,24 +2359,21 @@ void statement () {
 		a = text + 1;
 
 		match('(');
-		expression(Assign);
+		b = condition();
 		match(')');
 
-		*++text = JZ;
-		b = ++text;
-
 		statement();
 
 		*++text = JMP;
 		*++text = (int)a;
-		*b = (int)(text + 1);
+		patch(b, text + 1);
 	} else if (token == '{') {
 		
 		// { <statement> ... }
 		
 		match('{');
 
-		while (token != '}') statement();
+		while ( token && (token != '}') ) statement();
 
 		match('}');
 	} else if (token == Return) {
@@ -973,18 +2400,18 @@ void enum_declaration () {
 	// parse enum [id] { a = 1, b = 2, c = 3 ... }
 	int i;
 	i = 0;
-	while (token != '}') {
+	while ( token && (token != '}') ) {
 		if (token != Id) {
-			printf("ERROR : invalid enum identifier %d at line %d\n", token, line);
-			exit(-1);
+			fail("ERROR : invalid enum identifier %d at line %d\n", token, line);
+			return;
 		}
 		next();
 		if (token == Assign) {
 			// enum [id] { a = 1 }
 			next();
 			if (token != Num) {
-				printf("ERROR : invalid enum initialiser at line %d\n", line);
-				exit(-1);
+				fail("ERROR : invalid enum initialiser at line %d\n", line, 0);
+				return;
 			}
 			i = token_val;
 			next();
@@ -1002,7 +2429,7 @@ void function_parameter () {
 	int type;
 	int params;
 	params = 0;
-	while (token != ')') {
+	while ( token && (token != ')') ) {
 		// type of parameters
 		
 		type = INT;
@@ -1010,7 +2437,7 @@ void function_parameter () {
 		else if (token == Char) {
 			type = CHAR;
 			match(Char);
-		}
+		} else if (token == Struct) type = struct_type();
 
 		// pointer
 		while (token == Mul) {
@@ -1018,14 +2445,14 @@ void function_parameter () {
 			type = type + PTR;
 		}
 
-		// parameter name
-		if (token != Id) {
-			printf("ERROR : invalid parameter declartion at line %d\n", line);
-			exit(-1);
+		// parameter name, a struct only goes by pointer
+		if ( (token != Id) || ( (type > INT) && (type < PTR) ) ) {
+			fail("ERROR : invalid parameter declartion at line %d\n", line, 0);
+			return;
 		}
 		if (current_id[Class] == Loc) {
-			printf("ERROR : duplicate parameter declaration at line %d\n", line);
-			exit(-1);
+			fail("ERROR : duplicate parameter declaration at line %d\n", line, 0);
+			return;
 		}
 
 		match(Id);
@@ -1037,6 +2464,8 @@ void function_parameter () {
 		current_id[Type] = type;
 		current_id[BValue] = current_id[Value];
 		current_id[Value] = params++;
+		current_id[BSize] = current_id[Size];
+		current_id[Size] = 0;
 
 		if (token == ',') match(',');
 	}
@@ -1053,16 +2482,21 @@ void function_body () {
 	// }
 	
 	int pos_local; 		// position of local variables on the stack
-	int type;
+	int type, size;
+	int *id;
 
 	pos_local = index_of_bp;
+	member_at = 0;
 
-	while ( (token == Int || token == Char) ) {
+	while ( (token == Int) || (token == Char) || (token == Struct) ) {
 		// declare local variables
-		basetype = (token == Int) ? INT : CHAR;
-		match(token);
+		if (token == Struct) basetype = struct_type();
+		else {
+			basetype = (token == Int) ? INT : CHAR;
+			match(token);
+		}
 
-		while (token != ';') {
+		while ( token && (token != ';') ) {
 			type = basetype;
 			while (token == Mul) {
 				match(Mul);
@@ -1070,13 +2504,13 @@ void function_body () {
 			}
 			if (token != Id) {
 				// invalid declaration
-				printf("ERROR : invalid local declaration at line %d\n", line);
-				exit(-1);
+				fail("ERROR : invalid local declaration at line %d\n", line, 0);
+				return;
 			}
 			if (current_id[Class] == Loc) {
 				// duplicate declaration
-				printf("ERROR : duplicate local declaration at line %d\n", line);
-				exit(-1);
+				fail("ERROR : duplicate local declaration at line %d\n", line, 0);
+				return;
 			}
 			
 			match(Id);
@@ -1088,7 +2522,24 @@ void function_body () {
 			current_id[Type] = type;
 			current_id[BValue] = current_id[Value];
 			current_id[Value] = ++pos_local;
-			
+			current_id[BSize] = current_id[Size];
+			current_id[Size] = 0;
+
+			// an array, e.g. int buf[64], or a struct : ENT reserves it with the other locals and
+			// its bytes go up from the last of its slots, so that LEA of that slot is its address
+			if ( !(size = type_size(type)) ) {
+				fail("ERROR : incomplete struct at line %d\n", line, 0);
+				return;
+			}
+			id = current_id;
+			if (token == Brak) {
+				size = size * array_size(0);
+				id[Type] = type + PTR;
+				id[Size] = size;
+			}
+			pos_local = pos_local + (size - 1) / sizeof(int);
+			id[Value] = pos_local;
+
 			if (token == ',') match(',');
 		}
 
@@ -1098,216 +2549,2743 @@ void function_body () {
 	*++text = ENT;
 	*++text = pos_local - index_of_bp;
 
-	while (token != '}') statement();
+	while ( token && (token != '}') ) statement();
 
 	*++text = LEV;
 }
 
 
-void function_declaration () {
-	// |    ....       | 	high address
-	// +---------------+
-	// | arg: param_a  |    new_bp + 3
-	// +---------------+
-	// | arg: param_b  |    new_bp + 2
-	// +---------------+
-	// |return address |    new_bp + 1
-	// +---------------+
-	// | old BP        | <- new BP
-	// +---------------+
-	// | local_1       |    new_bp - 1
-	// +---------------+
-	// | local_2       |    new_bp - 2
-	// +---------------+
-	// |    ....       |  	low address
-	//
-	// In a function, the VM access the variable via new_bp pointer and the offset of a variable,
-	// therefore, it is important for us to know the number of arguments as well as the offset for each argument.
-	//
-	// variable_decl ::= type {'*'} id { ',' {'*'} id } ';'
-	// 
-	// function_decl ::= type {'*'} id '(' parameter_decl ')' '{' body_decl '}'
-	// 
-	// parameter_decl ::= type {'*'} id {',' type {'*'} id}
-	// 
-	// body_decl ::= {variable_decl}, {statement}
-	// 
-	// statement ::= non_empty_statement | empty_statement
-	// 
-	// non_empty_statement ::= if_statement | while_statement | '{' statement '}'
-	//                      | 'return' expression | expression ';'
-	// 
-	// if_statement ::= 'if' '(' expression ')' statement ['else' non_empty_statement]
-	// 
-	// while_statement ::= 'while' '(' expression ')' non_empty_statement
-	
-	match('(');
-	function_parameter();
-	match(')');
-	
-	match('{');
-	function_body();
-	// match('}'); 
-	// Note : Intuitively, we need to match the right bracket } indicating the end of a function. 
-	// However, if we consume that character here, the outer while loop going through the whole source code would not be able to know that the function has ended. 
-	// Therefore, we leave the consumption of character } to the outer loop.
-	
-	current_id = symbols;
-	while (current_id[Token]) {
-		if (current_id[Class] == Loc) {
-			// restore the information of global variables that are covered in 
-			current_id[Class] = current_id[BClass];
-			current_id[Type] = current_id[BType];
-			current_id[Value] = current_id[BValue];
-		}
-		current_id = current_id + IdSize;
-	}
+// IR
+// With -O, a function is still compiled to bytecode while parsing, but once its body is done the
+// bytecode is lifted into a linear IR, rewritten by the optimization passes and lowered back in
+// place. Without -O the bytecode emitted while parsing is kept as it is. The parser does not build
+// the IR itself, so it keeps the few rewrites it makes of what it just emitted, e.g. taking back
+// the last LI / LC to get an address for & or an assignment ; the passes only see whole functions.
+// examples/ has programs whose output must not change from -O0 to -O3, see make check.
+//
+// 		IR instruction:
+// +--+---+----+----+
+// |Op|Arg|Addr|Mark|
+// +--+---+----+----+
+//
+// Op / Arg : the instruction and its operand, for a jump the index of the instruction it jumps to,
+//            Op is -1 once the instruction is deleted
+// Addr : its address in the text segment, before lifting / after lowering
+// Mark : scratch for the passes
+
+enum {IrOp, IrArg, IrAddr, IrMark, IrSize};
 
+THREAD int *ir;			// the function being optimized
+THREAD int ir_len;			// number of instructions in it
+THREAD int *ir_at;			// index of the instruction at each word of the function
+
+int is_jump (int op) {
+	return (op == JMP) || ( (op >= JZ) && (op <= JGE) );
 }
 
-void global_declaration () {
-	// global_declaration ::= enum_decl | variable_decl | function_decl
-	//
-	// enum_decl ::= 'enum' [id] '{' id ['=' 'num'] {',' id ['=' 'num'} '}'
-	//
-	// variable_decl ::= type {'*'} id { ',' {'*'} id } ';'
-	//
-	// function_decl ::= type {'*'} id '(' parameter_decl ')' '{' body_decl '}'
-	int type, i;
+int *ir_ins (int i) {
+	return ir + i * IrSize;
+}
 
-	basetype = INT;
-	
-	// if (token == SYMBOL) is a look before piece that checks which type it is.
-	// e.g. if token is enum pcc knows it is a enumarator, if token is int, then we dont't know if it is a function or a varibale, then we need to take a look at a lookahead piece, if the lookahead piece gives us (, then it must be a function, otherwise its a varibale.
+int ir_live (int i) {
+	// first instruction from i on that is not deleted, ir_len if none
+	while ( (i < ir_len) && (ir[i * IrSize + IrOp] < 0) ) i++;
+	return i;
+}
 
-	// enum
-	if (token == Enum) {
-		// enum [id] { a = 10, b = 20, c = 30 ... }
-		match(Enum);
-		if (token != '{') match(Id);
-		if (token == '{') {
-			match('{');
-			enum_declaration();
-			match('}');
-		}
-		
-		match(';');
-		return;
+void ir_lift (int *start, int *end) {
+	int *pc, *r;
+	int i;
+
+	pc = start;
+	ir_len = 0;
+	while (pc < end) {
+		r = ir_ins(ir_len);
+		ir_at[pc - start] = ir_len++;
+		r[IrAddr] = (int)pc;
+		r[IrOp] = *pc++;
+		r[IrArg] = (r[IrOp] <= ADJ) ? *pc++ : 0;
+		r[IrMark] = 0;
 	}
 
-	// type information
-	if (token == Int) match(Int);
-	else if (token == Char) {
-		match(Char);
-		basetype = CHAR;
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i++);
+		if (is_jump(r[IrOp])) r[IrArg] = ir_at[(int *)r[IrArg] - start];
 	}
-	
-	// variable declaration
-	while ( (token != ';') && (token != '}') ) {
-		type = basetype;
-		
-		// pointer that start with * 
-		// could be int *x, **x, ***x, ...
-		// for all pointers, there must be a base type, e.g int, then the more level there is, the more * there is
-		// pcc does this by adding PTR to type
-		while (token == Mul) {
-			match(Mul);
-			type = type + PTR; 
+}
+
+int *ir_lower (int *start) {
+	// write the instructions left back from start, returns the last word written
+	int *pc, *r;
+	int i;
+
+	pc = start;
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i++);
+		r[IrAddr] = (int)pc;
+		if (r[IrOp] >= 0) pc = pc + ( (r[IrOp] <= ADJ) ? 2 : 1 );
+	}
+
+	pc = start;
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i++);
+		if (r[IrOp] >= 0) {
+			*pc++ = r[IrOp];
+			if (is_jump(r[IrOp])) *pc++ = ir_ins(r[IrArg])[IrAddr];
+			else if (r[IrOp] <= ADJ) *pc++ = r[IrArg];
 		}
-		if (token != Id) {
-			// declaration is invalid
-			printf("ERROR : invalid global declaration on line %d\n", line);
-			exit(-1);
+	}
+	return pc - 1;
+}
+
+int ir_clean () {
+	// jumps to jumps go straight to the end of the chain, unreachable instructions and
+	// JMPs to the next instruction go away, returns the number of changes
+	int *r;
+	int i, t, n, changes, more;
+
+	changes = 0;
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i++);
+		if (is_jump(r[IrOp])) {
+			t = ir_live(r[IrArg]);
+			n = 0;
+			while ( (t < ir_len) && (ir_ins(t)[IrOp] == JMP) && (n++ < ir_len) ) t = ir_live(ir_ins(t)[IrArg]);
+			if (t != r[IrArg]) {
+				r[IrArg] = t;
+				changes++;
+			}
 		}
-		if (current_id[Class]) {
-			// identifier exsists in Symbol table
-			printf("ERROR : duplicate global declaration on line %d\n", line);
-			exit(-1);
+	}
+
+	// reachable from the entry
+	i = 0;
+	while (i < ir_len) ir_ins(i++)[IrMark] = 0;
+	ir[IrMark] = 1;
+	more = 1;
+	while (more) {
+		more = 0;
+		i = 0;
+		while (i < ir_len) {
+			r = ir_ins(i++);
+			if ( (r[IrOp] >= 0) && r[IrMark] ) {
+				if ( (r[IrOp] != JMP) && (r[IrOp] != LEV) && ( (t = ir_live(i)) < ir_len ) && !ir_ins(t)[IrMark] ) {
+					ir_ins(t)[IrMark] = more = 1;
+				}
+				if ( is_jump(r[IrOp]) && ( (t = ir_live(r[IrArg])) < ir_len ) && !ir_ins(t)[IrMark] ) {
+					ir_ins(t)[IrMark] = more = 1;
+				}
+			}
 		}
-		
-		match(Id);
-		current_id[Type] = type;
-		
-		if (token == '(') {
-			// function
-			current_id[Class] = Fun;
-			current_id[Value] = (int)(text + 1); // Value stores the memory address of the function
-			function_declaration();
-		} else {
-			// variable
-			current_id[Class] = Glo; 
-			current_id[Value] = (int)data;
-			data = data + sizeof(int);
+	}
+
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i++);
+		if ( (r[IrOp] >= 0) && ( !r[IrMark] || ( (r[IrOp] == JMP) && (ir_live(r[IrArg]) == ir_live(i)) ) ) ) {
+			r[IrOp] = -1;
+			changes++;
 		}
+	}
+	return changes;
+}
 
-		if (token == ',') match(',');
+// Value numbering
+// Within a basic block every value gets a number, equal numbers meaning equal values. The values of
+// ax and of the stack are followed, and so is what the block stored to plain locations (a local,
+// LEA n, or a global, GLB addr). A run of pure instructions that leaves the stack as it found it
+// and ax with the value it had before the run does nothing, e.g. LEA -1, LI right after storing
+// the same value to that local, and is deleted. Stores, calls and builtins end runs, a store
+// through any other address or a call forgets what was known about memory.
+//
+// Value : |Op|A|B|Next|	Op / A / B : instruction and operands computing it, VnFresh for an unknown value
+//			Next : the value before it with the same hash of Op / A / B
+// Memory : |Loc|Char|Val|	Loc : value of the address, Char : loaded with LC
+// State : |Index|Depth|Ax|	before an instruction of the current run candidates
+
+enum {VnOp, VnA, VnB, VnNext, VnSize};
+enum {MemLoc, MemChar, MemVal, MemSize};
+enum {HistIndex, HistDepth, HistAx, HistSize};
+enum {VnFresh = 255, VStack = 1024, MaxHoist = 64};	// VnFresh : not an instruction
+enum {VnBuckets = 4096};
+
+THREAD int *vn, vn_len;		// value numbers of the block, 0 is unused
+THREAD int *vn_heads, vn_gen;		// |Gen|Head| for each hash : the last value with it, if Gen is vn_gen
+THREAD int *vmem, vmem_len;		// what is known to be in memory
+THREAD int *vstack, vdepth;		// values on the stack, vdepth from the start of the block
+THREAD int *vhist, vhist_len;		// states a run could start from
+THREAD int vax, vepoch;		// value of ax, count of stores
+THREAD int ir_dirty, ir_glo;		// collected : unknown stores / calls, stores to globals
+THREAD int *ir_locs, ir_locs_len;	// collected : locals stored to
+
+int vn_new (int op, int a, int b) {
+	int *v;
+	if ( (vn_len + 1) * VnSize * sizeof(int) >= poolsize ) {
+		// out of numbers : start over knowing nothing, like vn_reset(), the value is unknown too
+		vn_len = 1;
+		vn_gen++;
+		vmem_len = 0;
+		vhist_len = 0;
+		memset(vstack, 0, VStack * sizeof(int));
+		vdepth = 0;
+		op = VnFresh;
+		a = b = 0;
+		vax = vn_len;
 	}
-	
-	next();
+	v = vn + vn_len * VnSize;
+	v[VnOp] = op;
+	v[VnA] = a;
+	v[VnB] = b;
+	return vn_len++;
 }
 
-void program () {
-	// get next token
-	next();
-	while (token > 0) {
-		global_declaration();
+int vn_get (int op, int a, int b) {
+	int i, *v, *h;
+	h = vn_heads + ( ( (op * 31 + a) * 31 + b ) & (VnBuckets - 1) ) * 2;
+	i = (h[0] == vn_gen) ? h[1] : 0;
+	while (i) {
+		v = vn + i * VnSize;
+		if ( (v[VnOp] == op) && (v[VnA] == a) && (v[VnB] == b) ) return i;
+		i = v[VnNext];
 	}
+	i = vn_new(op, a, b);
+	v = vn + i * VnSize;
+	if (v[VnOp] == op) {
+		// not started over
+		v[VnNext] = (h[0] == vn_gen) ? h[1] : 0;
+		h[0] = vn_gen;
+		h[1] = i;
+	}
+	return i;
 }
 
-// VM
-int eval () {
-	int op, *tmp;
-	cycle = 0;
+int vn_fresh () {
+	return vn_new(VnFresh, 0, 0);
+}
 
-	while (1) {
-		// Get next command
-		cycle++;
-		op = *pc++;
-            	
-		if (DEBUG) {
-			printf("cycle %d > %.4s", cycle,
-					& 	"LEA ,IMM ,JMP ,CALL,JZ  ,JNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PUSH,"
-						"OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL  SHR  ADD ,SUB ,MUL ,DIV ,MOD ,"
-						"OPEN,READ,CLOS,PRTF,MALC,MSET,MCMP,EXIT"[op * 5]);
-			if (op <= ADJ) printf(" pc = %d\n", *pc);
-			else printf("\n");
-		}
+int ir_frame (int n) {
+	// is LEA n a parameter or a local, not a slot of the stack below them (used by inlined code)
+	return n >= -ir_ins(ir_live(0))[IrArg];
+}
 
-		//switch (op) {
-			// Operations / Instructions
+int vn_loc (int v) {
+	// is v the address of a plain location
+	return ( (vn[v * VnSize + VnOp] == LEA) && ir_frame(vn[v * VnSize + VnA]) ) || (vn[v * VnSize + VnOp] == IMM) || (vn[v * VnSize + VnOp] == GLB);
+}
 
-			// MOV
-			// MOV dest, source (basically moving the stuff in source to destination, could be anything)
-			// In pcc, we split MOV into 5 commands which only takes in at most 1 argument
-			// IMM <num> : Put <num> to ax
-			// LC : Load Char to ax addr
-			// LI : Load Integer to ax addr
-			// SC : Save Char from ax addr to Stack Top addr
-			// SI : Save Integer from ax addr to Stack Top addr
-			
-			
-			//case IMM :
-			//	ax = *pc++;			//load immediate value to ax
-			//	break;
-			//case LC :
-			//	ax = *(char *)ax;		//load char to ax addr;
-			//	break;
-			//case LI :
-			//	ax = *(int *)ax;		//load int to ax addr;
-			//	break;
-			//case SC :
-			//	ax = *(char *)*sp++ = ax;	//save char to stack top addr
-			//	break;
-			//case SI :
-			//	*(int *)*sp++ = ax;		//save int to stack top addr
-			//	break;
-			
-			
-			if 	(op == IMM)	{ ax = *pc++; }
-			else if (op == LC)	{ ax = *(char *)ax; }
-			else if (op == LI)	{ ax = *(int *)ax; }
-			else if (op == SC)	{ ax = *(char *)*sp++ = ax; }
-			else if (op == SI)	{ *(int *)*sp++ = ax; }
+void vn_reset () {
+	vn_len = 1;
+	vn_gen++;
+	vmem_len = 0;
+	vhist_len = 0;
+	memset(vstack, 0, VStack * sizeof(int));
+	vdepth = 0;
+	vax = vn_fresh();
+}
+
+void vn_push (int v) {
+	if (++vdepth >= VStack / 2) vn_reset();
+	else vstack[VStack / 2 + vdepth] = v;
+}
+
+int vn_pop () {
+	int v;
+	if (vdepth <= -VStack / 2) vn_reset();
+	v = vstack[VStack / 2 + vdepth];
+	vstack[VStack / 2 + vdepth--] = 0;
+	return v ? v : vn_fresh();
+}
+
+int mem_find (int loc, int chr) {
+	int *m, i;
+	i = 0;
+	while (i < vmem_len) {
+		m = vmem + i++ * MemSize;
+		if ( (m[MemLoc] == loc) && (m[MemChar] == chr) ) return m[MemVal];
+	}
+	return 0;
+}
+
+void mem_kill (int loc) {
+	// forget what is in loc, with anything overlapping it, 0 : everything
+	int *m, i, n;
+	i = n = 0;
+	while (i < vmem_len) {
+		m = vmem + i++ * MemSize;
+		if ( loc && (m[MemLoc] != loc) && ( (vn[loc * VnSize + VnOp] == LEA) || (vn[m[MemLoc] * VnSize + VnOp] == LEA) ) ) {
+			memcpy(vmem + n++ * MemSize, m, MemSize * sizeof(int));
+		}
+	}
+	vmem_len = n;
+}
+
+void mem_set (int loc, int chr, int v) {
+	int *m;
+	if ( (vmem_len + 1) * MemSize * sizeof(int) >= poolsize ) vmem_len = 0;
+	m = vmem + vmem_len++ * MemSize;
+	m[MemLoc] = loc;
+	m[MemChar] = chr;
+	m[MemVal] = v;
+}
+
+void ir_leaders () {
+	// Mark the first instruction of every basic block
+	int *r;
+	int i, t;
+
+	i = 0;
+	while (i < ir_len) ir_ins(i++)[IrMark] = 0;
+	ir[IrMark] = 1;
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i++);
+		if ( (r[IrOp] >= 0) && ( is_jump(r[IrOp]) || (r[IrOp] == LEV) ) ) {
+			if ( (t = ir_live(i)) < ir_len ) ir_ins(t)[IrMark] = 1;
+			if ( is_jump(r[IrOp]) && ( (t = ir_live(r[IrArg])) < ir_len ) ) ir_ins(t)[IrMark] = 1;
+		}
+	}
+}
+
+void ir_values (int from, int to, int collect) {
+	// value numbering over [from, to) with the leaders marked, deleting the runs that do nothing,
+	// or with collect set, only collecting the stores for ir_hoist()
+	int *r, *h;
+	int i, j, n, op, a;
+
+	if (collect) {
+		ir_dirty = ir_glo = ir_locs_len = 0;
+	}
+	vn_reset();
+	i = from;
+	while ( (i = ir_live(i)) < to ) {
+		r = ir_ins(i);
+		op = r[IrOp];
+		if (r[IrMark]) vn_reset();
+
+		h = vhist + vhist_len++ * HistSize;
+		h[HistIndex] = i;
+		h[HistDepth] = vdepth;
+		h[HistAx] = vax;
+
+		if ( (op == IMM) || (op == LEA) || (op == GLB) ) vax = vn_get(op, r[IrArg], 0);
+		else if ( (op == LI) || (op == LC) ) {
+			if (vn_loc(vax)) {
+				if ( !(a = mem_find(vax, op == LC)) ) mem_set(vax, op == LC, a = vn_fresh());
+				vax = a;
+			} else if (vn[vax * VnSize + VnOp] == LEA) vax = vn_fresh();	// a stack slot, PUSH writes those
+			else vax = vn_get(op, vax, vepoch);
+		} else if ( (op == LIO) || (op == LCO) ) {
+			// the same as PUSH, IMM offset, ADD, LI / LC
+			if ( (vn[vax * VnSize + VnOp] == LEA) && !vn_loc(vax) ) vax = vn_fresh();
+			else vax = vn_get( (op == LCO) ? LC : LI, vn_get(ADD, vax, vn_get(IMM, r[IrArg], 0)), vepoch );
+		}
+		else if (op == PUSH) vn_push(vax);
+		else if ( (op >= OR) && (op <= MOD) ) {
+			a = vn_pop();
+			vax = vn_get(op, a, vax);
+		} else {
+			// anything else has effects, no run goes across it
+			if ( (op == SI) || (op == SC) ) {
+				a = vn_pop();
+				vepoch++;
+				if (vn_loc(a)) {
+					mem_kill(a);
+					if (op == SI) mem_set(a, 0, vax);
+					if (vn[a * VnSize + VnOp] != LEA) ir_glo = 1;
+					else if (collect) ir_locs[ir_locs_len++] = vn[a * VnSize + VnA];
+				} else {
+					mem_kill(0);
+					ir_dirty = 1;
+				}
+				// SC leaves the value truncated to a char in ax
+				if (op == SC) vax = vn_fresh();
+			} else if ( (op == SIO) || (op == SCO) ) {
+				vn_pop();
+				vepoch++;
+				mem_kill(0);
+				ir_dirty = 1;
+				if (op == SCO) vax = vn_fresh();
+			} else if (op == ADJ) {
+				j = r[IrArg];
+				while (j > 0) {
+					vn_pop();
+					j--;
+				}
+				while (j++ < 0) vn_push(vn_fresh());
+			} else if ( (op >= JEQ) && (op <= JGE) ) vn_pop();
+			else if ( (op != JMP) && (op != JZ) && (op != JNZ) ) {
+				// CALL, builtins, ENT, LEV ...
+				mem_kill(0);
+				vepoch++;
+				vax = vn_fresh();
+				ir_dirty = 1;
+			}
+			vhist_len = 0;
+		}
+
+		// states deeper than the stack is now cannot start a run any more
+		j = n = 0;
+		while (j < vhist_len) {
+			h = vhist + j++ * HistSize;
+			if (h[HistDepth] <= vdepth) memcpy(vhist + n++ * HistSize, h, HistSize * sizeof(int));
+		}
+		vhist_len = n;
+
+		if (!collect) {
+			j = 0;
+			while ( (j < vhist_len) && ( (vhist[j * HistSize + HistDepth] != vdepth) || (vhist[j * HistSize + HistAx] != vax) ) ) j++;
+			if (j < vhist_len) {
+				// nothing changed since that state
+				a = vhist[j * HistSize + HistIndex];
+				while (a <= i) ir_ins(a++)[IrOp] = -1;
+				vhist_len = j;
+			}
+		}
+		i++;
+	}
+}
+
+// Loop-invariant code motion
+// A loop is the code from the target of a backward JMP to the JMP. A run of at least 3 pure
+// instructions in a loop that computes the same value at every iteration, from constants and
+// plain locations the loop never stores to, is computed once before the loop into a new local
+// and replaced by LEA t, LI. Only instructions that cannot fault are moved (no DIV / MOD, no loads
+// through computed addresses) since the loop may never have run them.
+
+int ir_stored (int n) {
+	int i;
+	i = 0;
+	while (i < ir_locs_len) {
+		if (ir_locs[i++] == n) return 1;
+	}
+	return 0;
+}
+
+int ir_run_end (int s, int to) {
+	// end of the longest loop invariant run from s, -1 if none
+	int *r;
+	int i, op, depth, count, loc, arg, best;
+
+	depth = count = loc = arg = 0;
+	best = -1;
+	i = s;
+	while ( ( (i = ir_live(i)) < to ) && ( (i == s) || !ir_ins(i)[IrMark] ) ) {
+		r = ir_ins(i);
+		op = r[IrOp];
+		if ( (op == IMM) || (op == LEA) || (op == GLB) ) {
+			loc = op;
+			arg = r[IrArg];
+		} else if ( (op == LI) || (op == LC) ) {
+			if ( ir_dirty || !( ( (loc == LEA) && ir_frame(arg) && !ir_stored(arg) ) || ( ( (loc == IMM) || (loc == GLB) ) && !ir_glo ) ) ) return best;
+			loc = 0;
+		} else if (op == PUSH) depth++;
+		else if ( (op >= OR) && (op <= MUL) && depth ) {
+			// DIV and MOD could fault
+			depth--;
+			loc = 0;
+		} else return best;
+		if ( (++count >= 3) && !depth ) best = i;
+		i++;
+	}
+	return best;
+}
+
+void ir_insert (int at, int n) {
+	// make room for n instructions before at
+	int *r;
+	int i;
+
+	if ( (ir_len + n) * IrSize * sizeof(int) >= poolsize * IrSize ) {
+		fail("ERROR : function too large for IR\n", 0, 0);
+		return;
+	}
+	i = ir_len;
+	while (i > at) {
+		i--;
+		memcpy(ir_ins(i + n), ir_ins(i), IrSize * sizeof(int));
+	}
+	ir_len = ir_len + n;
+	i = at;
+	while (i < at + n) {
+		r = ir_ins(i++);
+		r[IrOp] = -1;
+		r[IrAddr] = 0;
+	}
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i++);
+		if ( is_jump(r[IrOp]) && (r[IrArg] >= at) ) r[IrArg] = r[IrArg] + n;
+	}
+}
+
+void ir_set (int i, int op, int arg) {
+	int *r;
+	r = ir_ins(i);
+	r[IrOp] = op;
+	r[IrArg] = arg;
+	r[IrAddr] = 0;		// not the instruction the profile has counts for any more
+	r[IrMark] = 0;
+}
+
+void ir_move (int h, int j, int s, int k) {
+	// compute the run [s, k] of the loop [h, j] before the loop, into a new local
+	int *r;
+	int i, n, m, t;
+
+	// the new local, below the others, moving down the stack slots inlined code uses
+	r = ir_ins(ir_live(0));
+	t = -++r[IrArg];
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i++);
+		if ( (r[IrOp] == LEA) && (r[IrArg] <= t) ) r[IrArg]--;
+	}
+
+	n = 0;
+	i = s;
+	while ( (i = ir_live(i)) <= k ) {
+		n++;
+		i++;
+	}
+	// LEA t, PUSH, the run, SI
+	m = n + 3;
+	ir_insert(h, m);
+	ir_set(h, LEA, t);
+	ir_set(h + 1, PUSH, 0);
+	n = h + 2;
+	i = s + m;
+	while ( (i = ir_live(i)) <= k + m ) {
+		r = ir_ins(i++);
+		ir_set(n++, r[IrOp], r[IrArg]);
+	}
+	ir_set(n, SI, 0);
+
+	// entering the loop now goes through its new start
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i);
+		if ( is_jump(r[IrOp]) && (r[IrArg] == h + m) && ( (i < h + m) || (i > j + m) ) ) r[IrArg] = h;
+		i++;
+	}
+
+	// LEA t, LI instead of the run
+	s = ir_live(s + m);
+	ir_set(s, LEA, t);
+	s = ir_live(s + 1);
+	ir_set(s, LI, 0);
+	while ( (s = ir_live(s + 1)) <= k + m ) ir_ins(s)[IrOp] = -1;
+}
+
+int ir_hoist () {
+	// move one loop invariant run out of its loop, returns 1 if there was one
+	int *r;
+	int h, j, s, k, op;
+
+	ir_leaders();
+	j = 0;
+	while (j < ir_len) {
+		r = ir_ins(j);
+		if ( (r[IrOp] == JMP) && ( (h = ir_live(r[IrArg])) <= j ) ) {
+			ir_values(h, j + 1, 1);
+			s = h;
+			while ( (s = ir_live(s)) < j ) {
+				op = ir_ins(s)[IrOp];
+				if ( ( (op == IMM) || (op == LEA) || (op == GLB) ) && ( (k = ir_run_end(s, j)) >= 0 ) ) {
+					ir_move(h, j, s, k);
+					return 1;
+				}
+				s++;
+			}
+		}
+		j++;
+	}
+	return 0;
+}
+
+// Profile-guided optimization
+// pcc -p file compiles the program as it is written (no -O, no -l), counts while it runs how many
+// times each branch, call and function entry ran and how many times each branch jumped, and writes
+// the counts to file when it exits :
+//
+// at op runs taken	one line per JZ ... JGE, CALL and ENT, at : offset in words in the text segment
+//
+// pcc -P file compiles with these counts, at -O1 at least. The offsets refer to the code as the
+// parser emits it, so the profile must come from the same source; a count whose op does not match
+// the code at its offset is not used. Then
+// 1. a loop whose body ran tests its condition again at the end of the body rather than jumping
+//    back to it, which saves the JMP of every iteration (ir_rotate())
+// 2. the code a branch jumps over all but once every ProfRare times goes to the end of the
+//    function and the branch is inverted to jump to it, the likely path falls through (ir_layout())
+// 3. at -O3, a call that runs at least once per call of its caller inlines functions of up to
+//    HotInline words, a call that never ran is not inlined (ir_inline())
+// 4. functions that never ran are compiled to the upper half of the text segment, away from the
+//    others (global_declaration())
+
+enum {ProfOp, ProfRuns, ProfTaken, ProfSize};	// ProfOp : op + 1, 0 for no counts
+enum {InlineSize = 32, HotInline = 128, RotateSize = 16, ProfRare = 8};
+
+THREAD int *prof, prof_len;		// the profile of the next compile, ProfSize ints per word of code for prof_len words, 0 without one
+THREAD int code_at;			// offset of the function being compiled in the code as the parser emits it
+THREAD int *cold_text;			// where the functions that never ran go
+
+void prof_count (int *prog, int *at, int op, int ax, int top) {
+	// count in prog[Counts] the run of the instruction at, top : stack top before it runs
+	int *p;
+	int taken;
+
+	if ( (op < CALL) || (op > ENT) || (op == STUB) ) return;
+	p = (int *)prog[Counts] + (at - (int *)prog[Text]) * ProfSize;
+	p[ProfRuns]++;
+	if (op == JZ) taken = !ax;
+	else if (op == JNZ) taken = ax != 0;
+	else if (op == JEQ) taken = top == ax;
+	else if (op == JNE) taken = top != ax;
+	else if (op == JLT) taken = top < ax;
+	else if (op == JGT) taken = top > ax;
+	else if (op == JLE) taken = top <= ax;
+	else if (op == JGE) taken = top >= ax;
+	else taken = 0;
+	p[ProfTaken] = p[ProfTaken] + taken;
+}
+
+int *prof_find (int *r, int *start) {
+	// counts for the instruction of r in the function at start, 0 if there are none
+	int *p;
+	int at;
+
+	if ( !prof || !r[IrAddr] ) return 0;
+	at = code_at + ( (int *)r[IrAddr] - start );
+	if (at >= prof_len) return 0;
+	p = prof + at * ProfSize;
+	return (p[ProfOp] == r[IrOp] + 1) ? p : 0;
+}
+
+int ir_invert (int op) {
+	// the branch that jumps when op does not
+	if (op == JZ) return JNZ;
+	if (op == JNZ) return JZ;
+	if (op == JEQ) return JNE;
+	if (op == JNE) return JEQ;
+	if (op == JLT) return JGE;
+	if (op == JGE) return JLT;
+	if (op == JGT) return JLE;
+	return JGT;
+}
+
+int ir_alone (int from, int to) {
+	// is [from, to) only entered by falling into it
+	int *r;
+	int i, t;
+
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i);
+		if ( is_jump(r[IrOp]) && ( (i < from) || (i >= to) ) && ( (t = ir_live(r[IrArg])) >= from ) && (t < to) ) return 0;
+		i++;
+	}
+	return 1;
+}
+
+void ir_rotate (int *start) {
+	// copy the condition of the loops whose body ran to their end, see Profile-guided optimization
+	//
+	//  x: <c> JZ y            x: <c> JZ y
+	//  z: <b>          ->     z: <b>
+	//     JMP x                  <c> JNZ z
+	//  y:                     y:
+	int *r, *p;
+	int h, i, j, m, n, op;
+
+	j = 0;
+	while (j < ir_len) {
+		r = ir_ins(j);
+		if ( (r[IrOp] == JMP) && ( (h = ir_live(r[IrArg])) < j ) ) {
+			// the condition runs up to the first jump of the loop, which must leave it
+			m = 0;
+			i = h;
+			while ( ( (i = ir_live(i)) < j ) && !is_jump(op = ir_ins(i)[IrOp]) && (op != LEV) && (m < RotateSize) ) {
+				m++;
+				i++;
+			}
+			if ( (i < j) && (op >= JZ) && (op <= JGE) && ( ir_live(ir_ins(i)[IrArg]) == ir_live(j + 1) )
+					&& (p = prof_find(ir_ins(i), start)) && (p[ProfRuns] > p[ProfTaken]) ) {
+				ir_insert(j + 1, m);
+				n = j;
+				while ( (h = ir_live(h)) < i ) {
+					r = ir_ins(h++);
+					ir_set(n++, r[IrOp], r[IrArg]);
+				}
+				ir_set(n, ir_invert(op), ir_live(i + 1));
+				j = n;
+			}
+		}
+		j++;
+	}
+}
+
+void ir_layout (int *start) {
+	// move the code that branches rarely run to the end of the function
+	//
+	//     <a> JZ x            <a> JNZ y
+	//     <b>          ->  x: <c>
+	//  x: <c>                 ...
+	//     ...              y: <b> JMP x
+	int *r, *p;
+	int i, j, n, t, op;
+
+	ir_rotate(start);
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i);
+		op = r[IrOp];
+		if ( (op >= JZ) && (op <= JGE) && (p = prof_find(r, start)) && ( (p[ProfRuns] - p[ProfTaken]) * ProfRare < p[ProfRuns] )
+				&& ( (t = ir_live(r[IrArg])) > ir_live(i + 1) ) && ir_alone(ir_live(i + 1), t) ) {
+			// the code in (i, t) then JMP t, at the end
+			n = ir_len;
+			ir_insert(n, t - i);
+			j = i + 1;
+			while (j < t) {
+				memcpy(ir_ins(n + j - i - 1), ir_ins(j), IrSize * sizeof(int));
+				r = ir_ins(n + j - i - 1);
+				if ( is_jump(r[IrOp]) && (r[IrArg] > i) && (r[IrArg] < t) ) r[IrArg] = r[IrArg] + n - i - 1;
+				ir_ins(j++)[IrOp] = -1;
+			}
+			ir_set(n + t - i - 1, JMP, t);
+			ir_set(i, ir_invert(op), n);
+		}
+		i++;
+	}
+}
+
+int prof_cold () {
+	// does the profile say that the function at code_at never ran
+	int *p;
+
+	if ( !prof || ASM || lazy || (code_at >= prof_len) ) return 0;
+	p = prof + code_at * ProfSize;
+	return (p[ProfOp] == ENT + 1) && !p[ProfRuns];
+}
+
+void prof_swap () {
+	// switch between compiling to the hot and the cold part of the text segment
+	int *t;
+
+	t = text;
+	text = cold_text;
+	cold_text = t;
+}
+
+// Inlining
+// At -O3, a call to a small function that calls nothing is replaced by the code of the function.
+// Its arguments stay where the caller pushed them, its locals go right below them and its LEAs are
+// rebased on the frame of the caller, which needs the depth D of the stack at the call :
+//
+// +-------+
+// | arg 1 |	bp - D + n - 1		ADJ -k		room for the k locals
+// +-------+				... 		the code, a LEV being a JMP to the end
+// |  ...  |				ADJ n + k	instead of the ADJ n after the CALL
+// +-------+
+// | arg n |	bp - D
+// +-------+
+// |local 1|	bp - D - 1
+// +-------+
+// |  ...  |
+//
+// bp : base pointer of the caller
+
+THREAD int *ir_dep;			// stack depth before each instruction, -1 if unknown
+THREAD int *inl_at;			// index of the instruction at each word of the inlined function
+
+void ir_depths () {
+	// the depths all follow from ENT as jumps always leave the stack as deep as at their target
+	int *r;
+	int i, d, t, op;
+
+	i = 0;
+	while (i < ir_len) ir_dep[i++] = -1;
+	d = 0;
+	i = 0;
+	while (i < ir_len) {
+		r = ir_ins(i);
+		op = r[IrOp];
+		if (op >= 0) {
+			if (ir_dep[i] >= 0) d = ir_dep[i];
+			ir_dep[i] = d;
+			if (d >= 0) {
+				if (op == ENT) d = r[IrArg];
+				else if (op == PUSH) d++;
+				else if ( ( (op >= OR) && (op <= MOD) ) || (op == SI) || (op == SC) || (op == SIO) || (op == SCO) || ( (op >= JEQ) && (op <= JGE) ) ) d--;
+				else if (op == ADJ) d = d - r[IrArg];
+				if ( is_jump(op) && ( (t = ir_live(r[IrArg])) > i ) && (t < ir_len) ) ir_dep[t] = d;
+				if ( (op == JMP) || (op == LEV) ) d = -1;
+			}
+		}
+		i++;
+	}
+}
+
+int ir_callee (int *f, int *limit, int max) {
+	// words of code of the function at f if it has less than max and calls nothing, 0 otherwise
+	int *pc;
+	int op;
+
+	if (*f != ENT) return 0;
+	op = ENT;
+	pc = f + 2;
+	while ( (pc < limit) && (*pc != ENT) && (*pc != STUB) ) {
+		op = *pc;
+		if ( (op == CALL) || (pc - f >= max) ) return 0;
+		pc = pc + ( (op <= ADJ) ? 2 : 1 );
+	}
+	// the end is not reached by falling through either, e.g. laid out with a profile
+	return ( (op == LEV) || (op == JMP) ) ? pc - f : 0;
+}
+
+int ir_budget (int *r, int *start) {
+	// size limit of the functions to inline at the CALL of r, see Profile-guided optimization
+	int *p, *e;
+
+	if ( !(p = prof_find(r, start)) ) return InlineSize;
+	if (!p[ProfRuns]) return 0;
+	e = prof_find(ir_ins(0), start);
+	return ( e && (p[ProfRuns] >= e[ProfRuns]) ) ? HotInline : InlineSize;
+}
+
+void ir_inline (int *start) {
+	// inline the calls to small leaf functions, the last one first so that the depths stay right
+	int *r, *f, *pc;
+	int c, d, n, k, b, size, extra, base, end, i, op, arg;
+
+	ir_depths();
+	c = ir_len;
+	while (c-- > 0) {
+		r = ir_ins(c);
+		if ( (r[IrOp] == CALL) && ( (d = ir_dep[c]) >= 0 ) && ( size = ir_callee(f = (int *)r[IrArg], start, ir_budget(r, start)) ) ) {
+			// n arguments, popped by the ADJ right after the call
+			n = ( (c + 1 < ir_len) && (ir_ins(c + 1)[IrOp] == ADJ) ) ? ir_ins(c + 1)[IrArg] : 0;
+			k = f[1];
+
+			// b instructions after ENT, all parameters they use must have been passed
+			b = 0;
+			pc = f + 2;
+			while (pc < f + size) {
+				inl_at[pc - f] = b++;
+				if ( (*pc == LEA) && (pc[1] > 0) && (pc[1] - 2 >= n) ) b = size;
+				pc = pc + ( (*pc <= ADJ) ? 2 : 1 );
+			}
+
+			if (b < size) {
+				extra = (k > 0) + b - 1 + ( (k > 0) && !n );
+				ir_insert(c + 1, extra);
+				base = c + (k > 0);
+				end = base + b;
+				if (k > 0) ir_set(c, ADJ, -k);
+				if (n) ir_ins(end)[IrArg] = n + k;
+				else if (k > 0) ir_set(end, ADJ, k);
+
+				i = base;
+				pc = f + 2;
+				while (pc < f + size) {
+					op = *pc;
+					arg = (op <= ADJ) ? pc[1] : 0;
+					pc = pc + ( (op <= ADJ) ? 2 : 1 );
+					if (op == LEA) arg = (arg > 0) ? arg - 2 - d : arg - d;
+					else if (is_jump(op)) arg = base + inl_at[(int *)arg - f];
+					else if (op == LEV) {
+						// the last LEV falls through to the end
+						op = (pc == f + size) ? -1 : JMP;
+						arg = end;
+					}
+					ir_set(i++, op, arg);
+				}
+			}
+		}
+	}
+}
+
+// Compile-time evaluation
+// At -O2, a call whose arguments are all constants (IMM, PUSH each) is run right away in a sandbox,
+// a small VM over a stack of its own. If the function only used that stack, i.e. its parameters
+// and locals, ran no builtin and returned within FoldFuel instructions, the call and its
+// arguments are replaced by an IMM of the result. Anything else, e.g. a global, a pointer it was
+// not given by the sandbox, a division by 0 or a result pointing into the sandbox, gives up and
+// the call stays.
+//
+//  IMM 3, PUSH, IMM 4, PUSH, CALL f, ADJ 2	->	IMM f(3, 4)
+
+enum {FoldStack = 4096, FoldFuel = 65536};
+
+THREAD int *fold_stack;		// the sandbox stack
+THREAD int fold_val;			// result of the last fold_run()
+
+int fold_in (int a, int size) {
+	// is [a, a + size) in the sandbox stack
+	return (a >= (int)fold_stack) && (a + size <= (int)(fold_stack + FoldStack));
+}
+
+int fold_run (int *f, int n) {
+	// run the function at f over the n arguments on top of the sandbox stack, 1 if it folds
+	int *pc, *sp, *bp;
+	int ax, op, fuel;
+
+	sp = fold_stack + FoldStack - n;
+	*--sp = 0;			// returning to 0 ends the run
+	bp = 0;
+	ax = 0;
+	pc = f;
+	fuel = FoldFuel;
+	while (fuel--) {
+		if (sp < fold_stack + 2) return 0;
+		op = *pc++;
+		if (op == IMM)		ax = *pc++;
+		else if (op == LEA)	ax = (int)(bp + *pc++);
+		else if (op == LC)	{ if (!fold_in(ax, sizeof(char))) return 0; ax = *(char *)ax; }
+		else if (op == LI)	{ if (!fold_in(ax, sizeof(int))) return 0; ax = *(int *)ax; }
+		else if (op == SC)	{ if (!fold_in(*sp, sizeof(char))) return 0; ax = *(char *)*sp++ = ax; }
+		else if (op == SI)	{ if (!fold_in(*sp, sizeof(int))) return 0; *(int *)*sp++ = ax; }
+		else if (op == LCO)	{ if (!fold_in(ax + *pc, sizeof(char))) return 0; ax = *(char *)(ax + *pc++); }
+		else if (op == LIO)	{ if (!fold_in(ax + *pc, sizeof(int))) return 0; ax = *(int *)(ax + *pc++); }
+		else if (op == SCO)	{ if (!fold_in(*sp + *pc, sizeof(char))) return 0; ax = *(char *)(*sp++ + *pc++) = ax; }
+		else if (op == SIO)	{ if (!fold_in(*sp + *pc, sizeof(int))) return 0; *(int *)(*sp++ + *pc++) = ax; }
+		else if (op == PUSH)	*--sp = ax;
+		else if (op == JMP)	pc = (int *)*pc;
+		else if (op == JZ)	pc = ax ? pc + 1 : (int *)*pc;
+		else if (op == JNZ)	pc = ax ? (int *)*pc : pc + 1;
+		else if (op == JEQ)	pc = (*sp++ == ax) ? (int *)*pc : pc + 1;
+		else if (op == JNE)	pc = (*sp++ != ax) ? (int *)*pc : pc + 1;
+		else if (op == JLT)	pc = (*sp++ < ax) ? (int *)*pc : pc + 1;
+		else if (op == JGT)	pc = (*sp++ > ax) ? (int *)*pc : pc + 1;
+		else if (op == JLE)	pc = (*sp++ <= ax) ? (int *)*pc : pc + 1;
+		else if (op == JGE)	pc = (*sp++ >= ax) ? (int *)*pc : pc + 1;
+		else if (op == CALL)	{ if (is_link(*pc)) return 0; *--sp = (int)(pc + 1); pc = (int *)*pc; }
+		else if (op == ENT)	{ *--sp = (int)bp; bp = sp; sp = sp - *pc++; }
+		else if (op == ADJ)	sp = sp + *pc++;
+		else if (op == LEV) {
+			sp = bp;
+			bp = (int *)*sp++;
+			if ( !(pc = (int *)*sp++) ) {
+				fold_val = ax;
+				return !fold_in(ax, 1);
+			}
+		}
+		else if (op == OR)	ax = *sp++ | ax;
+		else if (op == XOR)	ax = *sp++ ^ ax;
+		else if (op == AND)	ax = *sp++ & ax;
+		else if (op == EQ)	ax = *sp++ == ax;
+		else if (op == NE)	ax = *sp++ != ax;
+		else if (op == LT)	ax = *sp++ < ax;
+		else if (op == LE)	ax = *sp++ <= ax;
+		else if (op == GT)	ax = *sp++ > ax;
+		else if (op == GE)	ax = *sp++ >= ax;
+		else if (op == SHL)	ax = *sp++ << ax;
+		else if (op == SHR)	ax = *sp++ >> ax;
+		else if (op == ADD)	ax = *sp++ + ax;
+		else if (op == SUB)	ax = *sp++ - ax;
+		else if (op == MUL)	ax = *sp++ * ax;
+		else if ( (op == DIV) && ax )	ax = *sp++ / ax;
+		else if ( (op == MOD) && ax )	ax = *sp++ % ax;
+		else return 0;		// builtins, STUB ...
+	}
+	return 0;
+}
+
+int ir_prev (int i) {
+	// last instruction before i that is not deleted, -1 if none
+	while ( (--i >= 0) && (ir[i * IrSize + IrOp] < 0) );
+	return i;
+}
+
+void ir_fold () {
+	// replace the calls with constant arguments by their result where the sandbox can run them
+	int *r;
+	int c, a, n, k, first;
+
+	if ( !fold_stack && !(fold_stack = malloc(FoldStack * sizeof(int))) ) {
+		fail("ERROR : could not malloc size of %d for sandbox\n", FoldStack * sizeof(int), 0);
+		return;
+	}
+	c = 0;
+	while (c < ir_len) {
+		r = ir_ins(c);
+		if ( (r[IrOp] == CALL) && !is_link(r[IrArg]) ) {
+			// the arguments, the last one first, go to the top of the sandbox stack
+			a = ir_live(c + 1);
+			n = ( (a < ir_len) && (ir_ins(a)[IrOp] == ADJ) ) ? ir_ins(a)[IrArg] : 0;
+			if (!n) a = c;
+			first = c;
+			k = n;
+			while ( (k > 0) && (n < FoldStack / 2) && ( (first = ir_prev(first)) >= 0 ) && (ir_ins(first)[IrOp] == PUSH)
+					&& ( (first = ir_prev(first)) >= 0 ) && (ir_ins(first)[IrOp] == IMM) ) {
+				fold_stack[FoldStack - k] = ir_ins(first)[IrArg];
+				k--;
+			}
+			if ( !k && ir_alone(first + 1, a + 1) && fold_run( (int *)r[IrArg], n ) ) {
+				k = first;
+				while ( (k = ir_live(k + 1)) <= a ) ir_ins(k)[IrOp] = -1;
+				ir_set(first, IMM, fold_val);
+			}
+		}
+		c++;
+	}
+}
+
+int *ir_optimize (int *start, int *end) {
+	// run the passes over the function in [start, end), returns its new last word
+	int n;
+
+	if ( !ir && ( !(ir = malloc(poolsize * IrSize)) || !(ir_at = malloc(poolsize)) || !(vn = malloc(poolsize)) ||
+			!(vmem = malloc(poolsize)) || !(vstack = malloc(VStack * sizeof(int))) || !(vhist = malloc(poolsize * HistSize)) ||
+			!(ir_locs = malloc(poolsize)) || !(ir_dep = malloc(poolsize)) || !(inl_at = malloc(HotInline * sizeof(int))) ||
+			!(vn_heads = malloc(VnBuckets * 2 * sizeof(int))) ) ) {
+		fail("ERROR : could not malloc size of %d for IR\n", poolsize * IrSize, 0);
+		return end - 1;
+	}
+	if (!vn_gen) memset(vn_heads, 0, VnBuckets * 2 * sizeof(int));	// not used yet
+	ir_lift(start, end);
+	if (OPT >= 2) ir_fold();
+	if (OPT >= 3) ir_inline(start);
+	if (OPT >= 2) {
+		n = 0;
+		while ( (n++ < MaxHoist) && ir_hoist() );
+		ir_leaders();
+		ir_values(0, ir_len, 0);
+	}
+	if (prof) ir_layout(start);
+	while (ir_clean());
+	if (failed) return end - 1;
+	return ir_lower(start);
+}
+
+void function_declaration () {
+	// |    ....       | 	high address
+	// +---------------+
+	// | arg: param_a  |    new_bp + 3
+	// +---------------+
+	// | arg: param_b  |    new_bp + 2
+	// +---------------+
+	// |return address |    new_bp + 1
+	// +---------------+
+	// | old BP        | <- new BP
+	// +---------------+
+	// | local_1       |    new_bp - 1
+	// +---------------+
+	// | local_2       |    new_bp - 2
+	// +---------------+
+	// |    ....       |  	low address
+	//
+	// In a function, the VM access the variable via new_bp pointer and the offset of a variable,
+	// therefore, it is important for us to know the number of arguments as well as the offset for each argument.
+	//
+	// variable_decl ::= type {'*'} id { ',' {'*'} id } ';'
+	// 
+	// function_decl ::= type {'*'} id '(' parameter_decl ')' '{' body_decl '}'
+	// 
+	// parameter_decl ::= type {'*'} id {',' type {'*'} id}
+	// 
+	// body_decl ::= {variable_decl}, {statement}
+	// 
+	// statement ::= non_empty_statement | empty_statement
+	// 
+	// non_empty_statement ::= if_statement | while_statement | '{' statement '}'
+	//                      | 'return' expression | expression ';'
+	// 
+	// if_statement ::= 'if' '(' expression ')' statement ['else' non_empty_statement]
+	// 
+	// while_statement ::= 'while' '(' expression ')' non_empty_statement
+
+	int *start, *end;
+
+	start = text + 1;
+	match('(');
+	function_parameter();
+	match(')');
+	
+	match('{');
+	function_body();
+	end = text + 1;
+	if (OPT && !ASM && !failed) text = ir_optimize(start, end);
+	code_at = code_at + (end - start);
+	// match('}'); 
+	// Note : Intuitively, we need to match the right bracket } indicating the end of a function. 
+	// However, if we consume that character here, the outer while loop going through the whole source code would not be able to know that the function has ended. 
+	// Therefore, we leave the consumption of character } to the outer loop.
+	
+	current_id = symbols;
+	while (current_id[Token]) {
+		if (current_id[Class] == Loc) {
+			// restore the information of global variables that are covered in 
+			current_id[Class] = current_id[BClass];
+			current_id[Type] = current_id[BType];
+			current_id[Value] = current_id[BValue];
+			current_id[Size] = current_id[BSize];
+		}
+		current_id = current_id + IdSize;
+	}
+
+}
+
+void skip_function () {
+	// scan from '(' to the '}' ending the body without compiling, token is left on '}' like function_declaration()
+	char *start;
+	int depth;
+
+	start = data;
+	while ( (token > 0) && (token != '{') ) next();
+	next();
+	depth = 0;
+	while ( (token > 0) && ( (token != '}') || depth) ) {
+		if (token == '{') depth++;
+		else if (token == '}') depth--;
+		next();
+	}
+	if (token <= 0) {
+		fail("ERROR : unexpected end of file in function body at line %d\n", line, 0);
+		return;
+	}
+	// the string literals met on the way were copied to data, give the space back
+	memset(start, 0, data - start);
+	data = start;
+}
+
+int is_prototype () {
+	// on the '(' after the name of a function, is it only declared : does ';' or ',' follow the ')'
+	char *p;
+	int depth;
+
+	p = src;
+	depth = 1;
+	while (*p && depth) {
+		if (*p == '(') depth++;
+		else if (*p == ')') depth--;
+		p++;
+	}
+	while ( (*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n') || ( (*p == '/') && (p[1] == '/') ) ) {
+		if (*p == '/') while (*p && (*p != '\n')) p++;
+		else p++;
+	}
+	return (*p == ';') || (*p == ',');
+}
+
+// Global variables
+// A global is laid out in the data segment at compile time together with its initial value, so a
+// table costs nothing at run time and its elements are next to each other :
+//
+//    int tbl[4] = {1, 2, 4, 8};		char *names[] = {"zero", "one"};
+//    char msg[] = "hello";			int n = -1;
+//
+// An initial value is a number, a char, an enum constant or a string, anything without one is 0.
+// The strings of an initializer go to the data segment as they are read, so the elements are kept
+// in init_vals and the array is placed after them once the initializer is done.
+
+THREAD int *init_vals;			// elements of the array initializer being read
+
+int const_value () {
+	// an initial value : ['-'] number / enum constant, or a string
+	int v, neg;
+
+	neg = 0;
+	if (token == Sub) {
+		match(Sub);
+		neg = 1;
+	}
+	if (token == Num) {
+		v = token_val;
+		match(Num);
+	} else if ( (token == Id) && (current_id[Class] == Num) ) {
+		v = current_id[Value];
+		match(Id);
+	} else if ( (token == '"') && !neg ) {
+		v = token_val;
+		match('"');
+		while (token == '"') match('"');
+		v = (int)str_intern( (char *)v );
+	} else {
+		fail("ERROR : invalid initializer on line %d\n", line, 0);
+		return 0;
+	}
+	return neg ? -v : v;
+}
+
+void global_variable (int *id, int type) {
+	// storage and initial value of the global id of type, after its name
+	int n, size, i;
+
+	if ( !(size = type_size(type)) ) {
+		fail("ERROR : incomplete struct on line %d\n", line, 0);
+		return;
+	}
+	n = 0;
+	if (token == Brak) {
+		// an array, [] takes its size from the initializer
+		if ( !(n = array_size(1)) ) n = -1;
+		id[Type] = type + PTR;
+	}
+	id[Class] = Glo;
+	id[Value] = (int)data;
+	id[Size] = 0;
+
+	if (!n) {
+		// its slot goes before the string of its value, if any
+		data = data + (size + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+		if (token == Assign) {
+			match(Assign);
+			if ( (type > INT) && (type < PTR) ) {
+				fail("ERROR : invalid initializer on line %d\n", line, 0);
+				return;
+			}
+			i = const_value();
+			if (type == CHAR) *(char *)id[Value] = i;
+			else *(int *)id[Value] = i;
+		}
+		return;
+	}
+
+	if (token != Assign) {
+		// all zero
+		if (n < 0) {
+			fail("ERROR : invalid array size on line %d\n", line, 0);
+			return;
+		}
+		id[Size] = n * size;
+		data = data + (id[Size] + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+		return;
+	}
+	match(Assign);
+
+	if ( (type == CHAR) && (token == '"') ) {
+		// char s[] = "..." : the string is already in the data segment, the array is that string
+		id[Value] = token_val;
+		match('"');
+		while (token == '"') match('"');
+		i = data - (char *)id[Value];
+		if (n < 0) n = i + 1;
+		else if (i > n) {
+			fail("ERROR : initializer too long on line %d\n", line, 0);
+			return;
+		}
+		id[Size] = n;
+		data = (char *)id[Value] + (n + sizeof(int)) / sizeof(int) * sizeof(int);
+		return;
+	}
+
+	if ( (type > INT) && (type < PTR) ) {
+		fail("ERROR : invalid initializer on line %d\n", line, 0);
+		return;
+	}
+	if ( !init_vals && !(init_vals = malloc(poolsize)) ) {
+		fail("ERROR : could not malloc initializer\n", 0, 0);
+		return;
+	}
+	match('{');
+	i = 0;
+	while ( token && (token != '}') ) {
+		if (i >= poolsize / sizeof(int)) {
+			fail("ERROR : initializer too long on line %d\n", line, 0);
+			return;
+		}
+		init_vals[i++] = const_value();
+		if (token != '}') match(',');
+	}
+	if (n < 0) n = i;
+	else if (i > n) {
+		fail("ERROR : initializer too long on line %d\n", line, 0);
+		return;
+	}
+	if (!n) {
+		fail("ERROR : invalid array size on line %d\n", line, 0);
+		return;
+	}
+
+	id[Value] = (int)data;
+	id[Size] = n * size;
+	while (i--) {
+		if (type == CHAR) data[i] = init_vals[i];
+		else *(int *)(data + i * sizeof(int)) = init_vals[i];
+	}
+	data = data + (id[Size] + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+	match('}');
+}
+
+void global_declaration () {
+	// global_declaration ::= enum_decl | struct_decl | variable_decl | function_decl
+	//
+	// enum_decl ::= 'enum' [id] '{' id ['=' 'num'] {',' id ['=' 'num'} '}'
+	//
+	// struct_decl ::= 'struct' id '{' field_decl {field_decl} '}' [variable_decl] ';'
+	//
+	// variable_decl ::= type {'*'} id ['[' [num] ']'] ['=' init] { ',' ... } ';'
+	//
+	// function_decl ::= type {'*'} id '(' parameter_decl ')' ( '{' body_decl '}' | ';' )
+	//
+	// extern_decl ::= 'extern' type {'*'} id ['(' parameter_decl ')' | '[' [num] ']'] { ',' ... } ';'
+	int type, i, cold, ext, n;
+	int *id, *ref;
+
+	basetype = INT;
+	
+	// if (token == SYMBOL) is a look before piece that checks which type it is.
+	// e.g. if token is enum pcc knows it is a enumarator, if token is int, then we dont't know if it is a function or a varibale, then we need to take a look at a lookahead piece, if the lookahead piece gives us (, then it must be a function, otherwise its a varibale.
+
+	// enum
+	if (token == Enum) {
+		// enum [id] { a = 10, b = 20, c = 30 ... }
+		match(Enum);
+		if (token != '{') match(Id);
+		if (token == '{') {
+			match('{');
+			enum_declaration();
+			match('}');
+		}
+		
+		match(';');
+		return;
+	}
+
+	// extern : only declared, see Linking
+	ext = 0;
+	if (token == Extern) {
+		match(Extern);
+		ext = 1;
+	}
+
+	// type information
+	if (token == Int) match(Int);
+	else if (token == Char) {
+		match(Char);
+		basetype = CHAR;
+	} else if (token == Struct) {
+		// struct id [{ ... }], see Structs
+		basetype = struct_type();
+		if (token == '{') {
+			match('{');
+			struct_declaration(basetype);
+			match('}');
+		}
+	}
+	
+	// variable declaration
+	while ( token && (token != ';') && (token != '}') ) {
+		type = basetype;
+		
+		// pointer that start with * 
+		// could be int *x, **x, ***x, ...
+		// for all pointers, there must be a base type, e.g int, then the more level there is, the more * there is
+		// pcc does this by adding PTR to type
+		while (token == Mul) {
+			match(Mul);
+			type = type + PTR; 
+		}
+		if (token != Id) {
+			// declaration is invalid
+			fail("ERROR : invalid global declaration on line %d\n", line, 0);
+			return;
+		}
+		id = current_id;
+		match(Id);
+
+		// the link record of a symbol only declared so far
+		ref = ( ( (id[Class] == Fun) || (id[Class] == Glo) ) && is_link(id[Value]) ) ? (int *)id[Value] : 0;
+
+		if ( ext || ( (token == '(') && is_prototype() ) ) {
+			// a declaration, the symbol is defined later or in another file
+			i = Glo;
+			n = 0;
+			if (token == '(') {
+				// the parameters do not matter
+				while ( token && (token != ')') ) next();
+				match(')');
+				i = Fun;
+			} else if (token == Brak) {
+				if ( !(n = array_size(1) * type_size(type)) ) n = -1;	// -1 : size unknown
+				type = type + PTR;
+			}
+			if (!id[Class]) {
+				id[Class] = i;
+				id[Type] = type;
+				id[Value] = link_ref(id);
+				id[Size] = n;
+			}
+		} else {
+			if ( id[Class] && !ref ) {
+				// identifier exsists in Symbol table
+				fail("ERROR : duplicate global declaration on line %d\n", line, 0);
+				return;
+			}
+			id[Type] = type;
+
+			if (token == '(') {
+				// function
+				id[Class] = Fun;
+				if ( (cold = prof_cold()) ) prof_swap();
+				id[Value] = (int)(text + 1); // Value stores the memory address of the function
+				if (lazy && !ASM) {
+					// leave a stub, see Lazy compilation
+					*++text = STUB;
+					*++text = (int)id;
+					*++text = (int)src;
+					*++text = line;
+					skip_function();
+				} else function_declaration();
+				if (cold) prof_swap();
+			} else global_variable(id, type);
+			if (ref) ref[LnkAddr] = id[Value];
+		}
+
+		if (token == ',') match(',');
+	}
+	
+	next();
+}
+
+void program () {
+	// get next token
+	next();
+	while (token > 0) {
+		global_declaration();
+	}
+}
+
+// Compiler context
+// The compiler works in THREAD variables, so that threads can compile side by side. A program keeps
+// the ones it needs to compile more later, i.e. the tables and the buffers of the compiler, in its
+// context prog[Compiler], one word for each of the variables cc_vars() lists :
+//
+// +-------+------+-------+---------+--    --+-----+---------+
+// |Symbols|Idmain|Structs|StructLen|   ..   |InlAt|FoldStack|
+// +-------+------+-------+---------+--    --+-----+---------+
+//
+// A compile starts from cc_clear(), which has every buffer allocated anew on first use, and
+// cc_save() hands them over to the program once it is over. lazy_compile() takes them back with
+// cc_load() while it compiles a function, pcc_free() frees them with cc_free(). The variables that
+// only hold the state of the compile going on, e.g. token, start again every compile.
+
+enum {
+	CcSymbols, CcIdmain, CcStructs, CcStructLen, CcFields, CcFieldLen,
+	CcStrs, CcStrLen, CcTails, CcTailLen, CcStrHeads, CcStrData,
+	CcPpStack, CcPpBuf, CcPpFiles, CcPpFilesLen, CcPpMain, CcInitVals,
+	CcIr, CcIrAt, CcVn, CcVnHeads, CcVnGen, CcVmem, CcVstack, CcVhist, CcIrLocs, CcIrDep, CcInlAt, CcFoldStack,
+	CcSize
+};
+
+void cc_vars (int **v) {
+	// the addresses of the variables of the context, in the order above, as the thread sees them
+	v[CcSymbols] = (int *)&symbols;		v[CcIdmain] = (int *)&idmain;
+	v[CcStructs] = (int *)&structs;		v[CcStructLen] = &struct_len;
+	v[CcFields] = (int *)&fields;		v[CcFieldLen] = &field_len;
+	v[CcStrs] = (int *)&strs;		v[CcStrLen] = &str_len;
+	v[CcTails] = (int *)&tails;		v[CcTailLen] = &tail_len;
+	v[CcStrHeads] = (int *)&str_heads;	v[CcStrData] = &str_data;
+	v[CcPpStack] = (int *)&pp_stack;	v[CcPpBuf] = (int *)&pp_buf;
+	v[CcPpFiles] = (int *)&pp_files;	v[CcPpFilesLen] = &pp_files_len;
+	v[CcPpMain] = (int *)&pp_main;		v[CcInitVals] = (int *)&init_vals;
+	v[CcIr] = (int *)&ir;			v[CcIrAt] = (int *)&ir_at;
+	v[CcVn] = (int *)&vn;			v[CcVnHeads] = (int *)&vn_heads;
+	v[CcVnGen] = &vn_gen;			v[CcVmem] = (int *)&vmem;
+	v[CcVstack] = (int *)&vstack;		v[CcVhist] = (int *)&vhist;
+	v[CcIrLocs] = (int *)&ir_locs;		v[CcIrDep] = (int *)&ir_dep;
+	v[CcInlAt] = (int *)&inl_at;		v[CcFoldStack] = (int *)&fold_stack;
+}
+
+void cc_save (int *prog) {
+	// hand the context of the thread over to prog
+	int *v[CcSize];
+	int i;
+
+	cc_vars(v);
+	i = 0;
+	while (i < CcSize) {
+		( (int *)prog[Compiler] )[i] = *v[i];
+		i++;
+	}
+}
+
+void cc_load (int *prog) {
+	// take the context of prog
+	int *v[CcSize];
+	int i;
+
+	cc_vars(v);
+	i = 0;
+	while (i < CcSize) {
+		*v[i] = ( (int *)prog[Compiler] )[i];
+		i++;
+	}
+}
+
+void cc_clear () {
+	// an empty context for the next compile, the one there was belongs to a program
+	int *v[CcSize];
+	int i;
+
+	cc_vars(v);
+	i = 0;
+	while (i < CcSize) *v[i++] = 0;
+}
+
+void cc_free (int *c) {
+	// free the buffers of the context c, not the symbol table, which is prog[Symbols]
+	int *f;
+	int i;
+
+	f = (int *)c[CcPpFiles];
+	i = c[CcPpFilesLen];
+	while (i--) {
+		munmap( (char *)f[FileText], f[FileLen] + 1 );
+		free( (char *)f[FileName] );
+		f = f + FileSize;
+	}
+	i = CcStructs;
+	while (i < CcSize) {
+		// the lengths and the rest that are not buffers are left out
+		if ( (i != CcStructLen) && (i != CcFieldLen) && (i != CcStrLen) && (i != CcTailLen) && (i != CcStrData) &&
+				(i != CcPpFilesLen) && (i != CcPpMain) && (i != CcVnGen) ) free( (char *)c[i] );
+		i++;
+	}
+	free(c);
+}
+
+// Lazy compilation
+// With LAZY set (pcc -l), global_declaration() only scans over function bodies and leaves a stub
+// in place of each function :
+//
+// +----+--+---+----+
+// |STUB|id|src|line|	id : its symbol, src / line : where its parameters start
+// +----+--+---+----+
+//
+// The first time a stub runs, lazy_compile() compiles the function at the end of the text segment
+// and turns the stub into a JMP to it. Only the functions that actually run are compiled, compile
+// errors in the others are never reported. A function with an error stays a stub, and the run that
+// called it stops with -1.
+//
+// The compiler runs on the thread of the run, in the context of the program (see Compiler context).
+// Runs of the same program on several threads take turns with prog[Lock], other programs compile
+// at the same time. A thread that waited may find the function compiled already.
+
+int *lazy_compile (int *prog, int *stub) {
+	// compile the function of stub, returns its address or 0 on a compile error
+	int *id, *fn;
+	char *start;
+
+	while (__sync_val_compare_and_swap(prog + Lock, 0, 1)) sched_yield();
+	if (stub[0] == JMP) {
+		__sync_val_compare_and_swap(prog + Lock, 1, 0);
+		return (int *)stub[1];
+	}
+
+	cc_load(prog);
+	id = (int *)stub[1];
+	text = (int *)prog[TextEnd];
+	data = start = (char *)prog[DataEnd];
+	links = (int *)prog[Links];
+	link_lo = (int)links;
+	link_hi = link_lo + poolsize;
+	src = (char *)stub[2];
+	line = stub[3];
+	token = '(';
+	cmp_at = 0;
+	expr_resume = 0;
+	failed = 0;
+	pp_len = pp_top = 0;
+
+	fn = text + 1;
+	function_declaration();
+	if ( !failed && !link_code(fn, text + 1) ) failed = 1;
+	cc_save(prog);
+	cc_clear();
+	if (failed) {
+		// the text and data it took are left over, the next compile starts from prog[TextEnd] again
+		__sync_val_compare_and_swap(prog + Lock, 1, 0);
+		return 0;
+	}
+	id[Value] = (int)fn;
+
+	// its string literals are part of the data segment of later runs too, in the image before
+	// pcc_start() on another thread copies that far
+	memcpy( (char *)prog[Image] + (start - (char *)prog[Data]), start, data - start);
+	prog[TextEnd] = (int)text;
+	prog[DataEnd] = (int)data;
+
+	// the target first : another thread may run the JMP as soon as it is there
+	stub[1] = (int)fn;
+	__sync_val_compare_and_swap(stub, STUB, JMP);
+	__sync_val_compare_and_swap(prog + Lock, 1, 0);
+	return fn;
+}
+
+void lazy_all (int *prog) {
+	// compile whatever has not been yet
+	int *id;
+
+	id = (int *)prog[Symbols];
+	while (id[Token]) {
+		if ( (id[Class] == Fun) && (*(int *)id[Value] == STUB) ) lazy_compile(prog, (int *)id[Value]);
+		id = id + IdSize;
+	}
+}
+
+// VM
+void vm_setup (int *vm, int *stack, int size, int *entry, int argc, int *args, int ret) {
+	// make vm call entry(args[0], ..., args[argc - 1]) on stack,
+	// what entry returns is then handed to the instruction ret (EXIT / CRET)
+	int *sp, *tmp;
+	int i;
+
+	vm[Stack] = (int)stack;
+
+	// setup stack
+	sp = (int *)( (int)stack + size );
+	*--sp = ret; // e.g. call exit if entry returns
+	*--sp = PUSH; tmp = sp;
+	i = 0;
+	while (i < argc) *--sp = args[i++];
+	*--sp = (int)tmp;
+
+	vm[Pc] = (int)entry;
+	vm[Bp] = vm[Sp] = (int)sp;
+	vm[Ax] = 0;
+	vm[Cycle] = 0;
+	vm[Fuel] = 0;
+	vm[Current] = 0;
+	vm[Prog] = 0;
+	vm[Globals] = 0;
+	vm[Pool] = 0;
+	vm[Worker] = 0;
+	vm[Coros] = 0;
+	vm[Caller] = 0;
+	vm[CoState] = 0;
+	// Out is kept, what is buffered still goes out
+}
+
+int *vm_create (int *entry, int argc, int *args) {
+	// create a context that calls entry(args[0], ..., args[argc - 1]) on a fresh stack,
+	// the context exits with what entry returns
+	int *vm, *stack;
+
+	if ( !(vm = malloc(VmSize * sizeof(int))) ) {
+		printf("ERROR : could not malloc VM context\n");
+		return 0;
+	}
+	if ( !(stack = malloc(poolsize)) ) {
+		printf("ERROR : could not malloc size of %d for stack area\n", poolsize);
+		free(vm);
+		return 0;
+	}
+	memset(stack, 0, poolsize);
+	vm_setup(vm, stack, poolsize, entry, argc, args, EXIT);
+	vm[Out] = 0;
+	return vm;
+}
+
+// Callbacks
+// A builtin calls an interpreted function with vm_call() : it sets up a frame below the stack
+// pointer of the running code, like vm_setup() does for main(), whose return address leads to
+// HRET instead of EXIT, and runs eval() on it. HRET returns from that inner eval() to the builtin,
+// then the registers of the running code are put back as they were.
+//
+// qsort(base, n, size, cmp) / bsearch(key, base, n, size, cmp) are the C library ones, only
+// their comparator cmp(a, b) runs interpreted, through call_cmp(). A comparator may sort again.
+// If it calls exit(), the comparisons that are left return 0 and the program exits once the
+// builtin has returned. Callbacks run on the fuel the caller has left, in vm[Fuel] while the
+// builtin runs (0 : no limit, -1 : none left). The C library can not be suspended, so a callback
+// that runs out of fuel goes on to its end, the ones after it run as well, and the caller suspends
+// as soon as the builtin returns. The instructions callbacks run count in vm[Cycle] of the caller.
+//
+// The C library gives the comparator no context, so each sort keeps its own in a record on the C
+// stack of call_sort(), and call_at points to the one of the innermost sort of the thread :
+//
+// +--+--+--+----+----+----+
+// |Vm|Sp|Fn|Exit|Code|Prev|	Vm / Sp / Fn : the comparator, where it runs
+// +--+--+--+----+----+----+	Exit / Code : it called exit(), with that code, Prev : the sort it runs in
+
+enum {CallVm, CallSp, CallFn, CallExit, CallCode, CallPrev, CallSize};
+
+int eval (int *vm);		// defined below, it runs the builtins that call vm_call()
+
+THREAD int *call_at;		// the sort running on the thread, 0 if none
+
+int vm_call (int *vm, int *sp, int *fn, int argc, int *args, int *exited) {
+	// run fn(args[0], ..., args[argc - 1]) on the stack of vm below sp, returns what fn returns,
+	// *exited : set to 1 if fn called exit()
+	int saved[Stack];
+	int *end;
+	int i;
+
+	// only the registers, Pc .. Current, go back : a pool or coroutines fn made are kept
+	memcpy(saved, vm, Stack * sizeof(int));
+	*--sp = HRET;
+	*--sp = PUSH;
+	end = sp + 2;
+	i = 0;
+	while (i < argc) *--sp = args[i++];
+	*--sp = (int)(end - 2);
+
+	vm[Pc] = (int)fn;
+	vm[Bp] = vm[Sp] = (int)sp;
+	vm[Ax] = 0;
+	vm[Cycle] = 0;
+	vm[Fuel] = (saved[Fuel] > 0) ? saved[Fuel] : 0;
+	vm[Current] = 0;
+	i = eval(vm);
+	while (vm[Current]) {
+		// out of fuel, fn still has to return to the C library
+		vm[Fuel] = 0;
+		i = eval(vm);
+	}
+	saved[Cycle] = saved[Cycle] + vm[Cycle];
+	if (saved[Fuel] > 0) saved[Fuel] = (vm[Cycle] < saved[Fuel]) ? saved[Fuel] - vm[Cycle] : -1;
+	*exited = vm[Pc] != (int)end;
+	memcpy(vm, saved, Stack * sizeof(int));
+	return i;
+}
+
+int call_cmp (char *a, char *b) {
+	// the comparator of the C library, it calls the interpreted one
+	int args[2];
+	int *c;
+	int i;
+
+	c = call_at;
+	if (c[CallExit]) return 0;
+	args[0] = (int)a;
+	args[1] = (int)b;
+	i = vm_call( (int *)c[CallVm], (int *)c[CallSp], (int *)c[CallFn], 2, args, c + CallExit );
+	if (c[CallExit]) c[CallCode] = i;
+	return (i > 0) - (i < 0);
+}
+
+int call_sort (int *vm, int *sp, int op, int *exit_code) {
+	// qsort() / bsearch() with their arguments at sp, returns 1 if the comparator called exit(),
+	// with its code in *exit_code, 0 otherwise with what the builtin returns there
+	int c[CallSize];
+	int i;
+
+	c[CallVm] = (int)vm;
+	c[CallSp] = (int)sp;
+	c[CallFn] = *sp;
+	c[CallExit] = 0;
+	c[CallPrev] = (int)call_at;
+	call_at = c;
+	i = 0;
+	if (op == QSRT) qsort( (char *)sp[3], sp[2], sp[1], (void *)call_cmp);
+	else i = (int)bsearch( (char *)sp[4], (char *)sp[3], sp[2], sp[1], (void *)call_cmp);
+	call_at = (int *)c[CallPrev];
+	*exit_code = c[CallExit] ? c[CallCode] : i;
+	return c[CallExit];
+}
+
+// Coroutines
+// coro_create(fn, arg) makes a coroutine that will run fn(arg). resume(co) runs it until it calls
+// yield(value) or fn returns, and returns value / what fn returned. coro_done(co) tells whether fn
+// has returned, coro_free(co) releases the coroutine.
+//
+// A coroutine is a context of its own, but it runs inside the eval() of the context that created
+// it : resume() and yield() only swap pc / bp / sp / ax. Its stack is a small CoroStack bytes slice
+// of a stack pool, one mmap-ed area per context where only the pages in use take memory.
+//
+// 		Stack pool:
+// +----+----+-------------------------+
+// |Free|Next| stack x MaxCoros        |
+// +----+----+-------------------------+
+//
+// Free : list of released stacks, linked through their first int
+// Next : number of stacks handed out from the area so far
+
+enum {CoroStack = 16384, MaxCoros = 4096};
+enum {CoroFree, CoroNext, CoroArea};
+enum {CoRunning = 1, CoSuspended, CoDone};
+
+int *coro_stack (int *vm) {
+	// a stack from the pool of vm
+	int *pool, *stack;
+
+	if ( !(pool = (int *)vm[Coros]) ) {
+		// PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+		if ( (pool = (int *)mmap(0, CoroArea * sizeof(int) + MaxCoros * CoroStack, 3, 0x4022, -1, 0)) == (int *)-1 ) {
+			printf("ERROR : could not mmap coroutine stack pool\n");
+			exit(-1);
+		}
+		vm[Coros] = (int)pool;
+	}
+	if ( (stack = (int *)pool[CoroFree]) ) {
+		pool[CoroFree] = *stack;
+		return stack;
+	}
+	if (pool[CoroNext] == MaxCoros) {
+		printf("ERROR : too many coroutines, at most %d\n", MaxCoros);
+		exit(-1);
+	}
+	return (int *)( (int)(pool + CoroArea) + pool[CoroNext]++ * CoroStack );
+}
+
+void coro_release (int *vm, int *co) {
+	// give the stack of co back to the pool of vm
+	int *pool, *stack;
+
+	if ( (stack = (int *)co[Stack]) ) {
+		pool = (int *)vm[Coros];
+		*stack = pool[CoroFree];
+		pool[CoroFree] = (int)stack;
+		co[Stack] = 0;
+	}
+}
+
+int *coro_new (int *vm, int fn, int arg) {
+	int *co;
+
+	if ( !(co = malloc(VmSize * sizeof(int))) ) {
+		printf("ERROR : could not malloc coroutine\n");
+		exit(-1);
+	}
+	vm_setup(co, coro_stack(vm), CoroStack, (int *)fn, 1, &arg, CRET);
+	co[Prog] = vm[Prog];
+	co[CoState] = CoSuspended;
+	co[Out] = 0; // it prints through the context running it
+	return co;
+}
+
+// Output
+// printf / puts / putchar / out_write append to one large buffer instead of writing each call, it
+// goes out when full, on fflush(), before fork() or reading stdin, when the program exits or
+// stops on an error, and when its context is freed. printf is formatted here one conversion at a
+// time, so it takes any number of arguments, and snprintf goes through the same code.
+//
+// out_write(buf, n) : append n raw bytes
+//
+// Each context has a buffer of its own in vm[Out], allocated on first use. The tasks a worker runs
+// print through the buffer of the worker, so their output stays in order with its own.
+//
+// 			 Output buffer:
+// +---+-------------+---------------+-------------+
+// |Len|out : OutSize|spec : SpecSize|tmp : TmpSize|
+// +---+-------------+---------------+-------------+
+//
+// Len : bytes waiting in out
+
+enum {OutSize = 65536, SpecSize = 32, TmpSize = 256};
+
+void out_raw (char *s, int n) {
+	int w;
+	while (n > 0) {
+		if ( (w = write(1, s, n)) <= 0 ) return;
+		s = s + w;
+		n = n - w;
+	}
+}
+
+void out_flush (int *vm) {
+	int *out;
+
+	// what pcc printed itself goes first
+	fflush(0);
+	if ( (out = (int *)vm[Out]) && *out ) {
+		out_raw( (char *)(out + 1), *out);
+		*out = 0;
+	}
+}
+
+void out_put (int *vm, char *s, int n) {
+	int *out;
+
+	if ( !(out = (int *)vm[Out]) ) {
+		if ( !(out = malloc(sizeof(int) + OutSize + SpecSize + TmpSize)) ) {
+			printf("ERROR : could not malloc size of %d for output buffer\n", OutSize);
+			exit(-1);
+		}
+		*out = 0;
+		vm[Out] = (int)out;
+	}
+	if (*out + n > OutSize) out_flush(vm);
+	if (n > OutSize) out_raw(s, n);
+	else {
+		memcpy( (char *)(out + 1) + *out, s, n);
+		*out = *out + n;
+	}
+	// keep the program output in step with the trace
+	if (DEBUG) out_flush(vm);
+}
+
+void vm_free (int *vm) {
+	if (vm[Out]) {
+		out_flush(vm);
+		free( (int *)vm[Out] );
+	}
+	free( (int *)vm[Stack] );
+	if (vm[Coros]) munmap( (char *)vm[Coros], CoroArea * sizeof(int) + MaxCoros * CoroStack);
+	free(vm);
+}
+
+void out_emit (int *vm, char *buf, int size, int at, char *s, int n) {
+	// n bytes of formatted output at offset at : to the output of vm, or into buf, size bytes long
+	if (!buf) out_put(vm, s, n);
+	else if (at < size - 1) memcpy(buf + at, s, (at + n < size - 1) ? n : size - 1 - at);
+}
+
+int out_printf (int *vm, char *buf, int size, char *fmt, int *args, int nargs) {
+	// printf(fmt, ...) with nargs arguments at args[0], args[-1], ..., or snprintf(buf, size, fmt, ...)
+	// if buf is not 0. Each conversion goes through snprintf() with the next three arguments, enough
+	// for "%*.*d"
+	char *s, *spec, *tmp;
+	int total, i, stars, conv, n, a, b, c;
+
+	out_put(vm, fmt, 0);
+	spec = (char *)( (int *)vm[Out] + 1 ) + OutSize;
+	total = 0;
+	i = 0;
+	while (*fmt) {
+		s = fmt;
+		while (*fmt && (*fmt != '%')) fmt++;
+		out_emit(vm, buf, size, total, s, fmt - s);
+		total = total + (fmt - s);
+
+		if (*fmt == '%') {
+			s = fmt++;
+			// flags, width, precision and length up to the conversion
+			stars = 0;
+			while ( (*fmt == '-') || (*fmt == '+') || (*fmt == ' ') || (*fmt == '#') || (*fmt == '.') || (*fmt == '*') ||
+					( (*fmt >= '0') && (*fmt <= '9') ) || (*fmt == 'h') || (*fmt == 'l') || (*fmt == 'z') || (*fmt == 'j') || (*fmt == 't') ) {
+				if (*fmt == '*') stars++;
+				fmt++;
+			}
+			if ( (conv = *fmt) ) fmt++;
+
+			a = (i < nargs) ? args[-i] : 0;
+			b = (i + 1 < nargs) ? args[-i - 1] : 0;
+			c = (i + 2 < nargs) ? args[-i - 2] : 0;
+
+			if ( (conv == '%') && (fmt - s == 2) ) {
+				out_emit(vm, buf, size, total, s, 1);
+				total++;
+			} else if ( !conv || (fmt - s >= SpecSize) ) {
+				// not a conversion, copy it as it is
+				out_emit(vm, buf, size, total, s, fmt - s);
+				total = total + (fmt - s);
+			} else if ( (conv == 's') && (fmt - s == 2) ) {
+				// plain %s, no copy
+				if (!a) a = (int)"(null)";
+				n = 0;
+				while ( ((char *)a)[n] ) n++;
+				out_emit(vm, buf, size, total, (char *)a, n);
+				total = total + n;
+				i++;
+			} else if (conv == 'n') {
+				*(int *)a = total;
+				i++;
+			} else {
+				memcpy(spec, s, fmt - s);
+				spec[fmt - s] = 0;
+				tmp = spec + SpecSize;
+				if ( (n = snprintf(tmp, TmpSize, spec, a, b, c)) >= TmpSize ) {
+					// too long for tmp, format it again in a buffer of its own
+					tmp = malloc(n + 1);
+					snprintf(tmp, n + 1, spec, a, b, c);
+					out_emit(vm, buf, size, total, tmp, n);
+					free(tmp);
+				} else if (n > 0) out_emit(vm, buf, size, total, tmp, n);
+				if (n > 0) total = total + n;
+				i = i + 1 + stars;
+			}
+		}
+	}
+	if (buf && (size > 0)) buf[(total < size - 1) ? total : size - 1] = 0;
+	return total;
+}
+
+// Event I/O
+// write / fcntl / pipe / socketpair / epoll_create1 / epoll_ctl / epoll_wait behave like in C. Kernel
+// structures have fixed 32-bit fields whatever an int is in the VM, so they are built byte by byte.
+// To spare interpreted programs from struct epoll_event, there are also :
+//
+// epoll_watch(epfd, op, fd, events) : epoll_ctl() for fd, e.g. epoll_watch(ep, EPOLL_CTL_ADD, fd, EPOLLIN)
+// epoll_fds(epfd, fds, max, timeout) : epoll_wait() storing the ready descriptors in the int array fds
+//
+// Both build the events in scratch space just below the stack top, hence at most MaxEvents at a time.
+//
+// struct epoll_event (packed) : |events : 4 bytes|data : 8 bytes|, the descriptor is kept in data
+
+enum {MaxEvents = 64, EventSize = 12};
+
+void put32 (char *p, int v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+int get32 (char *p) {
+	return (p[0] & 255) | ( (p[1] & 255) << 8 ) | ( (p[2] & 255) << 16 ) | (p[3] << 24);
+}
+
+int ev_watch (int epfd, int op, int fd, int events, char *ev) {
+	put32(ev, events);
+	put32(ev + 4, fd);
+	put32(ev + 8, 0);
+	return epoll_ctl(epfd, op, fd, (void *)ev);
+}
+
+int ev_fds (int epfd, int *fds, int max, int timeout, char *ev) {
+	int n, i;
+	if (max > MaxEvents) max = MaxEvents;
+	if ( (n = epoll_wait(epfd, (void *)ev, max, timeout)) > 0 ) {
+		i = 0;
+		while (i < n) {
+			fds[i] = get32(ev + i * EventSize + 4);
+			i++;
+		}
+	}
+	return n;
+}
+
+int fd_pair (int *fds, int ret, char *pair) {
+	// store the two descriptors a pipe() / socketpair() wrote to pair in fds
+	if (ret == 0) {
+		fds[0] = get32(pair);
+		fds[1] = get32(pair + 4);
+	}
+	return ret;
+}
+
+// Batched I/O
+// Instead of one blocking read() per call, requests are queued, submitted in one go and their
+// completions reaped later :
+//
+// q = ioq_create(entries)		a queue with room for entries requests in flight
+// ioq_read(q, fd, buf, len, off, tag)	queue a read of len bytes at offset off (-1 : current position), 0 / -1 when full
+// ioq_write(q, fd, buf, len, off, tag)	queue a write
+// ioq_submit(q)			submit the queued requests, returns how many
+// ioq_reap(q, res, max, wait)		store up to max completions as (tag, result) pairs in the int array res,
+//					waiting for at least wait of them, returns how many
+// ioq_free(q)
+//
+// The queue is an io_uring when the kernel has it (raw syscalls, rings built byte by byte like the
+// epoll events). Otherwise ioq_submit() hands the requests to IoWorkers threads of the queue, which
+// run them with read / write / pread / pwrite, so the program goes on while they block.
+// ioq_create() returns 0 and ioq_submit() -1 on failure, the requests that could not be submitted
+// then stay queued.
+//
+// 		Queue:
+// +--+-------+------+--------+----+----+--------+--------+----+--------+--------+----+-------+-------+----+---
+// |Fd|Entries|Queued|Inflight|Reqs|Done|DoneHead|DoneTail|Pend|PendHead|PendTail|Lock|Workers|Threads|Stop| ...
+// +--+-------+------+--------+----+----+--------+--------+----+--------+--------+----+-------+-------+----+---
+//
+// Fd : io_uring descriptor, -1 for the fallback
+// Reqs : requests queued by ioq_read / ioq_write, |Op|Fd|Buf|Len|Off|Tag| each
+// Done / DoneHead / DoneTail : ring of (tag, result) completions of the fallback
+// Pend / PendHead / PendTail : ring of the requests submitted to the workers of the fallback
+// Lock : guards the Done and Pend rings, Workers / Threads / Stop : the threads of the fallback
+// SqRing ... Cqes : the rings mapped from the kernel, pointers to their fields
+
+enum {UqFd, UqEntries, UqQueued, UqInflight, UqReqs, UqDone, UqDoneHead, UqDoneTail,
+	UqPend, UqPendHead, UqPendTail, UqLock, UqWorkers, UqThreads, UqStop,
+	UqSqRing, UqSqSize, UqCqRing, UqCqSize, UqSqes, UqSqesSize, UqSqTail, UqSqMask, UqSqArray,
+	UqCqHead, UqCqTail, UqCqMask, UqCqes, UqSize};
+enum {ReqOp, ReqFd, ReqBuf, ReqLen, ReqOff, ReqTag, ReqSize};
+enum {SqeSize = 64, CqeSize = 16, IoRead = 22, IoWrite = 23}; // IORING_OP_READ / IORING_OP_WRITE
+enum {IoWorkers = 4};
+
+void dq_lock (int *dq);		// defined below, see Tasks
+void dq_unlock (int *dq);
+void task_idle (int tries);
+
+void put64 (char *p, int v, int is_ptr) {
+	// 64-bit kernel field, pointers are unsigned
+	put32(p, v);
+	if (sizeof(int) > 4) put32(p + 4, (v >> 16) >> 16);
+	else put32(p + 4, (is_ptr || v >= 0) ? 0 : -1);
+}
+
+int get64 (char *p) {
+	if (sizeof(int) > 4) return (get32(p) & 4294967295) | ( (get32(p + 4) << 16) << 16 );
+	return get32(p);
+}
+
+// The ring heads and tails are shared with the kernel, while it runs : they are read and written
+// as one aligned word with __sync_val_compare_and_swap(), which is also a full barrier, so a tail
+// is never half old and half new and the entries are read after it, the head written after them.
+
+int ring_load (char *p) {
+	int *w;
+	int v;
+
+	w = (int *)( (int)p & -sizeof(int) );
+	v = __sync_val_compare_and_swap(w, 0, 0);
+	if (sizeof(int) > 4) v = (v >> ( (p - (char *)w) * 8 )) & 4294967295;
+	return v;
+}
+
+void ring_store (char *p, int v) {
+	int *w;
+	int old, now, shift, mask;
+
+	w = (int *)( (int)p & -sizeof(int) );
+	if (sizeof(int) > 4) {
+		// only the 32 bits of the field change
+		shift = (p - (char *)w) * 8;
+		mask = 4294967295 << shift;
+		v = (v << shift) & mask;
+	} else mask = -1;
+	old = *w;
+	while ( (now = __sync_val_compare_and_swap(w, old, (old & ~mask) | v)) != old ) old = now;
+}
+
+int uq_run (int *r) {
+	// run the request r now, returns its result
+	if (r[ReqOp] == IoRead) return (r[ReqOff] < 0) ? read(r[ReqFd], (char *)r[ReqBuf], r[ReqLen]) : pread(r[ReqFd], (char *)r[ReqBuf], r[ReqLen], r[ReqOff]);
+	return (r[ReqOff] < 0) ? write(r[ReqFd], (char *)r[ReqBuf], r[ReqLen]) : pwrite(r[ReqFd], (char *)r[ReqBuf], r[ReqLen], r[ReqOff]);
+}
+
+int uq_worker (int *q) {
+	// a thread of the fallback, it runs the submitted requests until the queue is freed
+	int *r, *done;
+	int i, res, idx, stop;
+
+	done = (int *)q[UqDone];
+	i = 0;
+	stop = 0;
+	while (!stop) {
+		r = 0;
+		dq_lock(q + UqLock);
+		if (q[UqPendHead] != q[UqPendTail]) r = (int *)q[UqPend] + q[UqPendHead]++ % q[UqEntries] * ReqSize;
+		stop = q[UqStop];
+		dq_unlock(q + UqLock);
+		if (r) {
+			// the slot stays as it is until the completion has been reaped
+			res = uq_run(r);
+			dq_lock(q + UqLock);
+			idx = q[UqDoneTail]++ % q[UqEntries] * 2;
+			done[idx] = r[ReqTag];
+			done[idx + 1] = res;
+			dq_unlock(q + UqLock);
+			i = 0;
+		} else if (!stop) task_idle(i++);
+	}
+	return 0;
+}
+
+void uq_unmap (int *q) {
+	// release the io_uring of q, what there is of it
+	if (q[UqSqRing] && (q[UqSqRing] != -1)) munmap( (char *)q[UqSqRing], q[UqSqSize]);
+	if (q[UqCqRing] && (q[UqCqRing] != -1)) munmap( (char *)q[UqCqRing], q[UqCqSize]);
+	if (q[UqSqes] && (q[UqSqes] != -1)) munmap( (char *)q[UqSqes], q[UqSqesSize]);
+	q[UqSqRing] = q[UqCqRing] = q[UqSqes] = 0;
+	if (q[UqFd] >= 0) close(q[UqFd]);
+	q[UqFd] = -1;
+}
+
+void uq_free (int *q) {
+	// also frees a queue that uq_create() left half done
+	int w;
+
+	if (q[UqWorkers]) {
+		dq_lock(q + UqLock);
+		q[UqStop] = 1;
+		dq_unlock(q + UqLock);
+		w = 0;
+		while (w < q[UqWorkers]) pthread_join( ((int *)q[UqThreads])[w++], 0);
+	}
+	uq_unmap(q);
+	free( (int *)q[UqReqs] );
+	free( (int *)q[UqDone] );
+	free( (int *)q[UqPend] );
+	free( (int *)q[UqThreads] );
+	free(q);
+}
+
+int *uq_create (int entries) {
+	int *q;
+	int sq_entries, cq_entries;
+	char *p, *sq, *cq;
+
+	if ( !(q = malloc(UqSize * sizeof(int))) ) {
+		printf("ERROR : could not malloc I/O queue\n");
+		return 0;
+	}
+	memset(q, 0, UqSize * sizeof(int));
+	q[UqEntries] = entries;
+	q[UqFd] = -1;
+	p = 0;
+	if ( (entries < 1) || !(q[UqReqs] = (int)malloc(entries * ReqSize * sizeof(int))) ||
+	     !(q[UqDone] = (int)malloc(entries * 2 * sizeof(int))) || !(p = malloc(120)) ) {
+		printf("ERROR : could not malloc I/O queue of %d entries\n", entries);
+		uq_free(q);
+		return 0;
+	}
+
+	// io_uring_setup(entries, struct io_uring_params *p)
+	memset(p, 0, 120);
+	if ( (q[UqFd] = syscall(425, entries, p)) >= 0 ) {
+		sq_entries = get32(p);
+		cq_entries = get32(p + 4);
+		// the rings : PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, IORING_OFF_SQ_RING / IORING_OFF_CQ_RING / IORING_OFF_SQES
+		q[UqSqSize] = get32(p + 64) + sq_entries * sizeof(int);
+		q[UqCqSize] = get32(p + 100) + cq_entries * CqeSize;
+		q[UqSqesSize] = sq_entries * SqeSize;
+		q[UqSqRing] = (int)mmap(0, q[UqSqSize], 3, 0x8001, q[UqFd], 0);
+		q[UqCqRing] = (int)mmap(0, q[UqCqSize], 3, 0x8001, q[UqFd], 0x8000000);
+		q[UqSqes] = (int)mmap(0, q[UqSqesSize], 3, 0x8001, q[UqFd], 0x10000000);
+		if ( (q[UqSqRing] == -1) || (q[UqCqRing] == -1) || (q[UqSqes] == -1) ) uq_unmap(q);
+		else {
+			// struct io_sqring_offsets at 40, struct io_cqring_offsets at 80
+			sq = (char *)q[UqSqRing];
+			cq = (char *)q[UqCqRing];
+			q[UqSqTail] = (int)(sq + get32(p + 44));
+			q[UqSqMask] = get32(sq + get32(p + 48));
+			q[UqSqArray] = (int)(sq + get32(p + 64));
+			q[UqCqHead] = (int)(cq + get32(p + 80));
+			q[UqCqTail] = (int)(cq + get32(p + 84));
+			q[UqCqMask] = get32(cq + get32(p + 88));
+			q[UqCqes] = (int)(cq + get32(p + 100));
+		}
+	} else q[UqFd] = -1;
+	free(p);
+
+	if (q[UqFd] < 0) {
+		// fallback : the worker threads
+		if ( !(q[UqPend] = (int)malloc(entries * ReqSize * sizeof(int))) || !(q[UqThreads] = (int)malloc(IoWorkers * sizeof(int))) ) {
+			printf("ERROR : could not malloc I/O queue of %d entries\n", entries);
+			uq_free(q);
+			return 0;
+		}
+		while ( (q[UqWorkers] < IoWorkers) && !pthread_create( (void *)((int *)q[UqThreads] + q[UqWorkers]), 0, (void *)uq_worker, q ) ) q[UqWorkers]++;
+		if (!q[UqWorkers]) {
+			printf("ERROR : could not create I/O worker\n");
+			uq_free(q);
+			return 0;
+		}
+	}
+	return q;
+}
+
+int uq_add (int *q, int op, int fd, int buf, int len, int off, int tag) {
+	int *r;
+	if (q[UqQueued] + q[UqInflight] >= q[UqEntries]) return -1;
+	r = (int *)q[UqReqs] + q[UqQueued]++ * ReqSize;
+	r[ReqOp] = op;
+	r[ReqFd] = fd;
+	r[ReqBuf] = buf;
+	r[ReqLen] = len;
+	r[ReqOff] = off;
+	r[ReqTag] = tag;
+	return 0;
+}
+
+int uq_submit (int *q) {
+	int *r;
+	int n, i, tail, idx, res;
+	char *sqe;
+
+	n = q[UqQueued];
+	r = (int *)q[UqReqs];
+	i = 0;
+	if (q[UqFd] < 0) {
+		// fallback : hand the requests to the workers, the completions wait for ioq_reap()
+		dq_lock(q + UqLock);
+		while (i < n) {
+			memcpy( (int *)q[UqPend] + q[UqPendTail]++ % q[UqEntries] * ReqSize, r + i * ReqSize, ReqSize * sizeof(int));
+			i++;
+		}
+		dq_unlock(q + UqLock);
+	} else {
+		// fill one struct io_uring_sqe per request
+		tail = ring_load( (char *)q[UqSqTail] );
+		while (i < n) {
+			idx = tail & q[UqSqMask];
+			sqe = (char *)q[UqSqes] + idx * SqeSize;
+			memset(sqe, 0, SqeSize);
+			*sqe = r[ReqOp];
+			put32(sqe + 4, r[ReqFd]);
+			put64(sqe + 8, r[ReqOff], 0);
+			put64(sqe + 16, r[ReqBuf], 1);
+			put32(sqe + 24, r[ReqLen]);
+			put64(sqe + 32, r[ReqTag], 0);
+			put32( (char *)q[UqSqArray] + idx * 4, idx);
+			tail++;
+			r = r + ReqSize;
+			i++;
+		}
+		ring_store( (char *)q[UqSqTail], tail);
+
+		// io_uring_enter(fd, to_submit, min_complete, flags, sig, sigsz)
+		i = 0;
+		while (i < n) {
+			if ( (res = syscall(426, q[UqFd], n - i, 0, 0, 0, 0)) <= 0 ) {
+				// the kernel has not read the entries left, take them back and keep their requests queued
+				ring_store( (char *)q[UqSqTail], tail - (n - i) );
+				r = (int *)q[UqReqs];
+				idx = 0;
+				while (idx < (n - i) * ReqSize) {
+					r[idx] = r[i * ReqSize + idx];
+					idx++;
+				}
+				q[UqInflight] = q[UqInflight] + i;
+				q[UqQueued] = n - i;
+				return -1;
+			}
+			i = i + res;
+		}
+	}
+	q[UqInflight] = q[UqInflight] + n;
+	q[UqQueued] = 0;
+	return n;
+}
+
+int uq_collect (int *q, int *res, int got, int max) {
+	// move the completions available now to res
+	int head, tail, *done;
+	char *cqe;
+
+	if (q[UqFd] < 0) {
+		done = (int *)q[UqDone];
+		dq_lock(q + UqLock);
+		while ( (q[UqDoneHead] != q[UqDoneTail]) && (got < max) ) {
+			head = q[UqDoneHead]++ % q[UqEntries] * 2;
+			res[got * 2] = done[head];
+			res[got * 2 + 1] = done[head + 1];
+			got++;
+		}
+		dq_unlock(q + UqLock);
+		return got;
+	}
+	head = ring_load( (char *)q[UqCqHead] );
+	tail = ring_load( (char *)q[UqCqTail] );
+	while ( (head != tail) && (got < max) ) {
+		cqe = (char *)q[UqCqes] + (head & q[UqCqMask]) * CqeSize;
+		res[got * 2] = get64(cqe);
+		res[got * 2 + 1] = get32(cqe + 8);
+		got++;
+		head++;
+	}
+	ring_store( (char *)q[UqCqHead], head);
+	return got;
+}
+
+int uq_reap (int *q, int *res, int max, int wait) {
+	int got, tries;
+
+	if (wait > q[UqInflight]) wait = q[UqInflight];
+	if (wait > max) wait = max;
+	got = uq_collect(q, res, 0, max);
+	tries = 0;
+	while (got < wait) {
+		if (q[UqFd] < 0) task_idle(tries++);
+		// io_uring_enter(fd, 0, min_complete, IORING_ENTER_GETEVENTS, 0, 0), on error return what there is
+		else if (syscall(426, q[UqFd], 0, wait - got, 1, 0, 0) < 0) wait = 0;
+		got = uq_collect(q, res, got, max);
+	}
+	q[UqInflight] = q[UqInflight] - got;
+	return got;
+}
+
+// Tasks
+// spawn(fn, arg) runs fn(arg) as a task and returns a handle, join(handle) waits for the task and
+// returns what fn returned.
+//
+// Tasks are run by a pool of worker threads created at the first spawn(), one per core besides the
+// thread running main. They all run on the text segment, the data segment and the heap of the
+// program. A worker has a context of its own that only holds what its tasks run with, and every
+// task runs in a context of its own, on a stack of TaskStack bytes. The contexts of the tasks that
+// are over are kept as spares for the next ones, so a task costs no malloc() once the pool has
+// warmed up.
+//
+// Scheduling is work stealing : every thread of the pool (0 is the one running main) owns a deque.
+// spawn() pushes to the bottom of its own deque, a thread looking for work pops the bottom of its
+// own deque and steals from the top of the others when it is empty. join() runs tasks while waiting.
+//
+// 				Pool:
+// +----+-------+----+-----+---------+--------------------+--------------------+-----------------+
+// |Stop|Workers|Next|Spare|SpareLock| thread x MaxWorkers | deque x MaxWorkers | task x MaxTasks |
+// +----+-------+----+-----+---------+--------------------+--------------------+-----------------+
+//
+// Spare : the first spare task context, the next one is in its Caller
+// deque : |Lock|Top|Bottom| task x MaxQueue |
+// task  : |Fn|Arg|State|Result|
+
+enum {MaxWorkers = 64, MaxQueue = 1024, MaxTasks = 16384, TaskStack = 65536};
+enum {PoolStop, PoolWorkers, PoolNext, PoolSpare, PoolSpareLock, PoolThreads};
+enum {DqLock, DqTop, DqBottom, DqItems};
+enum {TaskFn, TaskArg, TaskState, TaskResult, TaskSize};
+enum {TaskFree, TaskQueued, TaskRunning, TaskDone};
+
+int pool_size () {
+	return (PoolThreads + MaxWorkers + MaxWorkers * (DqItems + MaxQueue) + MaxTasks * TaskSize) * sizeof(int);
+}
+
+int *pool_deque (int *pool, int w) {
+	return pool + PoolThreads + MaxWorkers + w * (DqItems + MaxQueue);
+}
+
+int *pool_task (int *pool, int i) {
+	return pool + PoolThreads + MaxWorkers + MaxWorkers * (DqItems + MaxQueue) + i * TaskSize;
+}
+
+int is_task (int *pool, int *task) {
+	// is task the address of a task of pool, e.g. a handle given to join()
+	int *first;
+	first = pool_task(pool, 0);
+	return (task >= first) && (task < pool_task(pool, MaxTasks)) && !( (task - first) % TaskSize );
+}
+
+void dq_lock (int *dq) {
+	while (__sync_val_compare_and_swap(dq + DqLock, 0, 1)) sched_yield();
+}
+
+void dq_unlock (int *dq) {
+	__sync_val_compare_and_swap(dq + DqLock, 1, 0);
+}
+
+int dq_push (int *dq, int *task) {
+	// push task to the bottom of dq, 0 if dq is full
+	int ok;
+	ok = 0;
+	dq_lock(dq);
+	if (dq[DqBottom] - dq[DqTop] < MaxQueue) {
+		dq[DqItems + dq[DqBottom] % MaxQueue] = (int)task;
+		dq[DqBottom]++;
+		ok = 1;
+	}
+	dq_unlock(dq);
+	return ok;
+}
+
+int *dq_take (int *dq, int steal) {
+	// pop the bottom of dq (the owner) or the top of dq (steal), 0 if dq is empty
+	int *task;
+	task = 0;
+	dq_lock(dq);
+	if (dq[DqBottom] > dq[DqTop]) {
+		if (steal) task = (int *)dq[DqItems + dq[DqTop]++ % MaxQueue];
+		else task = (int *)dq[DqItems + --dq[DqBottom] % MaxQueue];
+		if (dq[DqBottom] == dq[DqTop]) dq[DqBottom] = dq[DqTop] = 0;
+	}
+	dq_unlock(dq);
+	return task;
+}
+
+int *task_new (int *pool, int fn, int arg) {
+	// find a free task slot
+	int *task;
+	int n;
+	n = 0;
+	while (n < MaxTasks) {
+		task = pool_task(pool, __sync_fetch_and_add(pool + PoolNext, 1) & (MaxTasks - 1));
+		if (!__sync_val_compare_and_swap(task + TaskState, TaskFree, TaskQueued)) {
+			task[TaskFn] = fn;
+			task[TaskArg] = arg;
+			return task;
+		}
+		n++;
+	}
+	printf("ERROR : too many tasks, at most %d can be pending\n", MaxTasks);
+	exit(-1);
+}
+
+int *task_take (int *vm) {
+	// find work for the thread of vm : its own deque first, then steal from the others
+	int *pool, *task;
+	int w, i, n;
+
+	pool = (int *)vm[Pool];
+	w = vm[Worker];
+	n = pool[PoolWorkers];
+	if ( (task = dq_take(pool_deque(pool, w), 0)) ) return task;
+	i = 1;
+	while (i < n) {
+		if ( (task = dq_take(pool_deque(pool, (w + i) % n), 1)) ) return task;
+		i++;
+	}
+	return 0;
+}
+
+int *task_start (int *vm, int *task) {
+	// returns a context running task for the thread of vm, a spare one if there is
+	int *pool, *t;
+
+	task[TaskState] = TaskRunning;
+	pool = (int *)vm[Pool];
+	dq_lock(pool + PoolSpareLock);
+	if ( (t = (int *)pool[PoolSpare]) ) pool[PoolSpare] = t[Caller];
+	dq_unlock(pool + PoolSpareLock);
+	if ( !t && ( !(t = malloc(VmSize * sizeof(int))) || !(t[Stack] = (int)malloc(TaskStack)) ) ) {
+		printf("ERROR : could not malloc task context\n");
+		exit(-1);
+	}
+	vm_setup(t, (int *)t[Stack], TaskStack, (int *)task[TaskFn], 1, task + TaskArg, EXIT);
+	out_put(vm, "", 0);
+	t[Out] = vm[Out];
+	t[Prog] = vm[Prog];
+	t[Globals] = vm[Globals];
+	t[Pool] = vm[Pool];
+	t[Worker] = vm[Worker];
+	return t;
+}
+
+void task_finish (int *task, int *t, int result) {
+	// task is over with result, t becomes a spare
+	int *pool;
+
+	if (t[Coros]) munmap( (char *)t[Coros], CoroArea * sizeof(int) + MaxCoros * CoroStack);
+	t[Out] = 0; // the buffer of the worker
+	pool = (int *)t[Pool];
+	dq_lock(pool + PoolSpareLock);
+	t[Caller] = pool[PoolSpare];
+	pool[PoolSpare] = (int)t;
+	dq_unlock(pool + PoolSpareLock);
+	task[TaskResult] = result;
+	// also a barrier : the result is visible before the state
+	__sync_val_compare_and_swap(task + TaskState, TaskRunning, TaskDone);
+}
+
+void task_idle (int tries) {
+	// back off when there has been no work for a while
+	if (tries < 64) sched_yield();
+	else usleep(200);
+}
+
+void data_private (char *seg, int size) {
+	// remap the shared data segment seg of size bytes private in place, keeping its content,
+	// see Separate compiling
+	char *copy;
+	if ( !(copy = malloc(size)) ) {
+		printf("ERROR : could not malloc size of %d for data copy\n", size);
+		exit(-1);
+	}
+	memcpy(copy, seg, size);
+	// MAP_PRIVATE (2) | MAP_FIXED (0x10) | MAP_ANONYMOUS (0x20)
+	if ( mmap(seg, size, 3, 0x32, -1, 0) != seg ) {
+		printf("ERROR : could not remap data segment\n");
+		exit(-1);
+	}
+	memcpy(seg, copy, size);
+	free(copy);
+}
+
+int data_size (int *prog) {
+	// bytes of the data segment of prog, a slice of poolsize per file
+	return prog[Units] * poolsize;
+}
+
+void data_copy (int *prog, char *to, char *from) {
+	// copy the globals of prog from the data segment from to to, both laid out like prog[Data],
+	// only the used part of the slice of each file
+	int *t;
+	int k, off, end;
+
+	t = (int *)prog[Links];
+	k = 0;
+	while (k < prog[Units]) {
+		off = k * poolsize;
+		// the last file also has the literals of the lazily compiled functions
+		end = (k == prog[Units] - 1) ? prog[DataEnd] : t[LtData];
+		memcpy(to + off, from + off, end - prog[Data] - off);
+		t = t + poolsize / sizeof(int);
+		k++;
+	}
+}
+
+char *vm_data (int *vm) {
+	// the data segment vm runs with
+	return vm[Globals] ? (char *)vm[Globals] : (char *)( (int *)vm[Prog] )[Data];
+}
+
+int pool_worker (int *c) {
+	// a worker thread of the pool, c : its context, it runs tasks until the pool stops
+	int *pool, *task, *t;
+	int i;
+
+	pool = (int *)c[Pool];
+	i = 0;
+	while (!pool[PoolStop]) {
+		if ( (task = task_take(c)) ) {
+			t = task_start(c, task);
+			task_finish(task, t, eval(t));
+			i = 0;
+		} else task_idle(i++);
+	}
+	if (c[Out]) {
+		out_flush(c);
+		free( (int *)c[Out] );
+	}
+	free(c);
+	return 0;
+}
+
+void pool_start (int *vm) {
+	// create the pool of vm and start its workers
+	int *pool, *c;
+	int n, w;
+
+	if (!vm[Prog]) {
+		printf("ERROR : spawn outside of a program\n");
+		exit(-1);
+	}
+	// PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS
+	if ( (pool = (int *)mmap(0, pool_size(), 3, 0x22, -1, 0)) == (int *)-1 ) {
+		printf("ERROR : could not mmap size of %d for task pool\n", pool_size());
+		exit(-1);
+	}
+	if ( (n = sysconf(84)) < 1) n = 1; // _SC_NPROCESSORS_ONLN
+	if (n > MaxWorkers) n = MaxWorkers;
+	pool[PoolWorkers] = n;
+	vm[Pool] = (int)pool;
+	vm[Worker] = 0;
+
+	w = 1;
+	while (w < n) {
+		if ( !(c = malloc(VmSize * sizeof(int))) ) {
+			printf("ERROR : could not malloc worker context\n");
+			exit(-1);
+		}
+		memcpy(c, vm, VmSize * sizeof(int));
+		c[Worker] = w;
+		c[Out] = 0;
+		c[Coros] = 0;
+		if ( pthread_create( (void *)(pool + PoolThreads + w), 0, (void *)pool_worker, c ) ) {
+			printf("ERROR : could not create task worker\n");
+			exit(-1);
+		}
+		w++;
+	}
+}
+
+void pool_stop (int *vm) {
+	// stop the workers of vm, free the pool
+	int *pool, *t;
+	int w;
+
+	pool = (int *)vm[Pool];
+	pool[PoolStop] = 1;
+	w = 1;
+	while (w < pool[PoolWorkers]) pthread_join(pool[PoolThreads + w++], 0);
+	while ( (t = (int *)pool[PoolSpare]) ) {
+		pool[PoolSpare] = t[Caller];
+		free( (int *)t[Stack] );
+		free(t);
+	}
+	munmap( (char *)pool, pool_size());
+	vm[Pool] = 0;
+}
+
+// Threads
+// pthread_create(&thread, attr, fn, arg) runs fn(arg) in a context of its own on a new thread of the
+// host, with the globals of the program that created it, attr is ignored. pthread_join(thread, &r)
+// waits for it and stores what fn returned in r.
+
+int thread_run (int *t) {
+	// a thread of a program, t : its context
+	int i;
+
+	i = eval(t);
+	vm_free(t);
+	return i;
+}
+
+int thread_create (int *vm, int *sp) {
+	// pthread_create() with its arguments at sp, for the program running vm
+	int *t;
+	int i;
+
+	if ( !(t = vm_create( (int *)sp[1], 1, sp)) ) return -1;
+	t[Prog] = vm[Prog];
+	t[Globals] = vm[Globals];
+	if ( (i = pthread_create( (void *)sp[3], 0, (void *)thread_run, t )) ) vm_free(t);
+	return i;
+}
+
+int eval (int *vm) {
+	// run vm until it exits and return the exit code,
+	// or until vm[Fuel] instructions have run, then vm[Current] is set and eval(vm) goes on from there
+	int op, *tmp, *t, *c;
+	int *pc, *bp, *sp, ax, cycle;
+	int i, fuel, watch;
+	int *cur;			// context running now, vm or one of its coroutines
+	int *prog;			// the program, when its runs are counted
+	int glb;			// from the data segment of the program to the one of the run
+
+	// the registers are kept in locals while running and written back when eval() returns
+	cur = vm[Current] ? (int *)vm[Current] : vm;
+	vm[Current] = 0;
+	pc = (int *)cur[Pc];
+	bp = (int *)cur[Bp];
+	sp = (int *)cur[Sp];
+	ax = cur[Ax];
+	cycle = vm[Cycle];
+	fuel = vm[Fuel] ? vm[Fuel] + 1 : 0;
+	prog = ( vm[Prog] && ( (int *)vm[Prog] )[Counts] ) ? (int *)vm[Prog] : 0;
+	watch = DEBUG || prog;		// one test per instruction for both
+	glb = vm[Globals] ? vm[Globals] - ( (int *)vm[Prog] )[Data] : 0;
+
+	while (1) {
+		if (fuel && !--fuel) {
+			// out of fuel, suspend
+			cur[Pc] = (int)pc; cur[Bp] = (int)bp; cur[Sp] = (int)sp; cur[Ax] = ax;
+			vm[Cycle] = cycle;
+			vm[Current] = (int)cur;
+			return 0;
+		}
+
+		// Get next command
+		cycle++;
+		op = *pc++;
+            	
+		if (watch) {
+			if (DEBUG) {
+				printf("cycle %d > %.4s", cycle,
+						& 	"LEA ,IMM ,GLB ,JMP ,CALL,JZ  ,JNZ ,JEQ ,JNE ,JLT ,JGT ,JLE ,JGE ,STUB,ENT ,LIO ,LCO ,SIO ,SCO ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PUSH,CRET,HRET,"
+							"OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL  SHR  ADD ,SUB ,MUL ,DIV ,MOD ,"
+							"OPEN,READ,CLOS,PRTF,MALC,FREE,MSET,MCMP,MCPY,MMAP,MUNM,FORK,WAIT,QUIT,FLSH,SCNF,SYLD,USLP,"
+							"ATAD,ACAS,SPWN,JOIN,COCR,RSME,YELD,CODN,COFR,WRIT,FCNT,PIPE,SKPR,EPCR,EPCT,EPWT,EPWA,EPFD,"
+							"PRED,PWRT,SYSC,LSEK,IOQC,IOQR,IOQW,IOQS,IOQP,IOQF,"
+							"SNPR,PUTS,PUTC,OUTW,SOCK,BIND,LSTN,ACPT,DUP2,UNLK,QSRT,BSRC,THCR,THJN,EXIT"[op * 5]);
+				if (op <= ADJ) printf(" pc = %d\n", *pc);
+				else printf("\n");
+			}
+			if (prog) prof_count(prog, pc - 1, op, ax, *sp);
+		}
+
+		//switch (op) {
+			// Operations / Instructions
+
+			// MOV
+			// MOV dest, source (basically moving the stuff in source to destination, could be anything)
+			// In pcc, we split MOV into 5 commands which only takes in at most 1 argument
+			// IMM <num> : Put <num> to ax
+			// GLB <addr> : Put the address of the global at <addr> in the data segment of the program to ax
+			// LC : Load Char to ax addr
+			// LI : Load Integer to ax addr
+			// SC : Save Char from ax addr to Stack Top addr
+			// SI : Save Integer from ax addr to Stack Top addr
+			
+			
+			//case IMM :
+			//	ax = *pc++;			//load immediate value to ax
+			//	break;
+			//case LC :
+			//	ax = *(char *)ax;		//load char to ax addr;
+			//	break;
+			//case LI :
+			//	ax = *(int *)ax;		//load int to ax addr;
+			//	break;
+			//case SC :
+			//	ax = *(char *)*sp++ = ax;	//save char to stack top addr
+			//	break;
+			//case SI :
+			//	*(int *)*sp++ = ax;		//save int to stack top addr
+			//	break;
+			
+			
+			if 	(op == IMM)	{ ax = *pc++; }
+			else if (op == GLB)	{ ax = *pc++ + glb; }
+			else if (op == LC)	{ ax = *(char *)ax; }
+			else if (op == LI)	{ ax = *(int *)ax; }
+			else if (op == SC)	{ ax = *(char *)*sp++ = ax; }
+			else if (op == SI)	{ *(int *)*sp++ = ax; }
+			else if (op == LCO)	{ ax = *(char *)(ax + *pc++); }
+			else if (op == LIO)	{ ax = *(int *)(ax + *pc++); }
+			else if (op == SCO)	{ ax = *(char *)(*sp++ + *pc++) = ax; }
+			else if (op == SIO)	{ *(int *)(*sp++ + *pc++) = ax; }
 
 
 			// PUSH
@@ -1346,6 +5324,23 @@ int eval () {
 			else if (op == JZ)	{ pc = ax ? pc + 1 : (int *)*pc; }
 			else if (op == JNZ)	{ pc = ax ? (int *)*pc : pc + 1; }
 
+			// JEQ / JNE / JLT / JGT / JLE / JGE
+			// compare and branch : compare the stack top with ax like EQ ... GE do, jump when it holds
+			
+			else if (op == JEQ)	{ pc = (*sp++ == ax) ? (int *)*pc : pc + 1; }
+			else if (op == JNE)	{ pc = (*sp++ != ax) ? (int *)*pc : pc + 1; }
+			else if (op == JLT)	{ pc = (*sp++ < ax) ? (int *)*pc : pc + 1; }
+			else if (op == JGT)	{ pc = (*sp++ > ax) ? (int *)*pc : pc + 1; }
+			else if (op == JLE)	{ pc = (*sp++ <= ax) ? (int *)*pc : pc + 1; }
+			else if (op == JGE)	{ pc = (*sp++ >= ax) ? (int *)*pc : pc + 1; }
+			else if (op == STUB)	{
+				// compile the function on its first call
+				if ( !(pc = lazy_compile( (int *)vm[Prog], pc - 1)) ) {
+					out_flush(vm);
+					return -1;
+				}
+			}
+
 			// Subroutine
 			// CALL <addr> : call subroutine at <addr>. Note this is different from JMP since we need to store the current pc for future coming back to.
 			// RET : return from subroutine (replaced by LEV)
@@ -1448,7 +5443,6 @@ int eval () {
 			// These commands requires extensive knowledge to implement, such that we will simply use built-in functions provided.
 			
 			//case EXIT :
-			//	printf("EXIT : %d\n", *sp);
 			//	return *sp;
 			//	break;
 			//case OPEN :
@@ -1467,22 +5461,202 @@ int eval () {
 			//case MALC :
 			//	ax = (int)malloc(*sp);
 			//	break;
+			//case FREE :
+			//	free( (char *)*sp);
+			//	break;
 			//case MSET :
 			//	ax = (int)memset( (char *)sp[2], sp[1], *sp);
 			//	break;
 			//case MCMP :
 			//	ax = memcmp( (char *)sp[2], (char *)sp[1], *sp);
 			//	break;
+			//case MCPY :
+			//	ax = (int)memcpy( (char *)sp[2], (char *)sp[1], *sp);
+			//	break;
 						
-			else if (op == EXIT)	{ printf("EXIT : %d\n", *sp); return *sp; }
-			else if (op == OPEN)	{ ax = open( (char *)sp[1], sp[0]); }
+			else if (op == EXIT)	{
+				vm[Pc] = (int)pc; vm[Bp] = (int)bp; vm[Sp] = (int)sp; vm[Ax] = ax; vm[Cycle] = cycle;
+				out_flush(vm);
+				return *sp;
+			}
+			else if (op == OPEN)	{ tmp = sp + pc[1]; ax = open( (char *)tmp[-1], tmp[-2], tmp[-3]); }	// the mode is optional
 			
 			else if (op == CLOS)	{ ax = close(*sp); }
-			else if (op == READ) 	{ ax = read(sp[2], (char *)sp[1], *sp); }
-			else if (op == PRTF)	{ tmp = sp + pc[1]; ax = printf( (char *)tmp[-1], tmp[-2], tmp[-3], tmp[-4], tmp[-5], tmp[-6]); }
+			else if (op == READ) 	{ if (!sp[2]) out_flush(vm); ax = read(sp[2], (char *)sp[1], *sp); }
+			else if (op == PRTF)	{ tmp = sp + pc[1]; ax = out_printf(vm, 0, 0, (char *)tmp[-1], tmp - 2, pc[1] - 1); }
 			else if (op == MALC)	{ ax = (int)malloc(*sp); }
+			else if (op == FREE)	{ free( (char *)*sp); }
 			else if (op == MSET) 	{ ax = (int)memset( (char *)sp[2], sp[1], *sp); }
 			else if (op == MCMP) 	{ ax = memcmp( (char *)sp[2], (char *)sp[1], *sp); }
+			else if (op == MCPY) 	{ ax = (int)memcpy( (char *)sp[2], (char *)sp[1], *sp); }
+			else if (op == MMAP)	{ ax = (int)mmap( (char *)sp[5], sp[4], sp[3], sp[2], sp[1], *sp); }
+			else if (op == MUNM)	{ ax = munmap( (char *)sp[1], *sp); }
+			else if (op == FORK)	{ out_flush(vm); ax = fork(); }
+			else if (op == WAIT)	{ ax = waitpid(sp[2], (int *)sp[1], *sp); }
+			else if (op == QUIT)	{ out_flush(vm); _exit(*sp); }
+			else if (op == FLSH)	{ out_flush(vm); ax = fflush( (void *)*sp); }
+			else if (op == SCNF)	{ ax = sysconf(*sp); }
+			else if (op == SYLD)	{ ax = sched_yield(); }
+			else if (op == USLP)	{ ax = usleep(*sp); }
+			else if (op == ATAD)	{ ax = __sync_fetch_and_add( (int *)sp[1], *sp); }
+			else if (op == ACAS)	{ ax = __sync_val_compare_and_swap( (int *)sp[2], sp[1], *sp); }
+
+			// Event I/O
+			// FCNT takes 2 or 3 arguments, so like PRTF it finds them with the ADJ that follows
+			// EPWA / EPFD / PIPE / SKPR use the free stack below sp as scratch space, see Event I/O
+
+			else if (op == WRIT)	{ if (sp[2] == 1) out_flush(vm); ax = write(sp[2], (char *)sp[1], *sp); }
+			else if (op == FCNT)	{ tmp = sp + pc[1]; ax = fcntl(tmp[-1], tmp[-2], tmp[-3]); }
+			else if (op == PIPE)	{ tmp = sp - 4; ax = fd_pair( (int *)*sp, pipe( (int *)tmp), (char *)tmp); }
+			else if (op == SKPR)	{ tmp = sp - 4; ax = fd_pair( (int *)*sp, socketpair(sp[3], sp[2], sp[1], (int *)tmp), (char *)tmp); }
+			else if (op == EPCR)	{ ax = epoll_create1(*sp); }
+			else if (op == EPCT)	{ ax = epoll_ctl(sp[3], sp[2], sp[1], (void *)*sp); }
+			else if (op == EPWT)	{ ax = epoll_wait(sp[3], (void *)sp[2], sp[1], *sp); }
+			else if (op == EPWA)	{ ax = ev_watch(sp[3], sp[2], sp[1], *sp, (char *)(sp - 4)); }
+			else if (op == EPFD)	{ ax = ev_fds(sp[3], (int *)sp[2], sp[1], *sp, (char *)sp - MaxEvents * EventSize - 16); }
+
+			// Batched I/O
+			// SYSC takes any number of arguments, so like PRTF it finds them with the ADJ that follows
+
+			else if (op == PRED)	{ ax = pread(sp[3], (char *)sp[2], sp[1], *sp); }
+			else if (op == PWRT)	{ ax = pwrite(sp[3], (char *)sp[2], sp[1], *sp); }
+			else if (op == SYSC)	{ tmp = sp + pc[1]; ax = syscall(tmp[-1], tmp[-2], tmp[-3], tmp[-4], tmp[-5], tmp[-6], tmp[-7]); }
+			else if (op == LSEK)	{ ax = lseek(sp[2], sp[1], *sp); }
+			else if (op == IOQC)	{ ax = (int)uq_create(*sp); }
+			else if (op == IOQR)	{ ax = uq_add( (int *)sp[5], IoRead, sp[4], sp[3], sp[2], sp[1], *sp); }
+			else if (op == IOQW)	{ ax = uq_add( (int *)sp[5], IoWrite, sp[4], sp[3], sp[2], sp[1], *sp); }
+			else if (op == IOQS)	{ ax = uq_submit( (int *)*sp); }
+			else if (op == IOQP)	{ ax = uq_reap( (int *)sp[3], (int *)sp[2], sp[1], *sp); }
+			else if (op == IOQF)	{ uq_free( (int *)*sp); }
+
+			// Output
+
+			else if (op == SNPR)	{ tmp = sp + pc[1]; ax = out_printf(vm, (char *)tmp[-1], tmp[-2], (char *)tmp[-3], tmp - 4, pc[1] - 3); }
+			else if (op == PUTS)	{ ax = out_printf(vm, 0, 0, "%s\n", sp, 1); }
+			else if (op == PUTC)	{ ax = *sp & 255; out_put(vm, (char *)&ax, 1); }
+			else if (op == OUTW)	{ out_put(vm, (char *)sp[1], *sp); ax = *sp; }
+
+			// Sockets
+
+			else if (op == SOCK)	{ ax = socket(sp[2], sp[1], *sp); }
+			else if (op == BIND)	{ ax = bind(sp[2], (void *)sp[1], *sp); }
+			else if (op == LSTN)	{ ax = listen(sp[1], *sp); }
+			else if (op == ACPT)	{ ax = accept(sp[2], (void *)sp[1], (void *)*sp); }
+			else if (op == DUP2)	{ ax = dup2(sp[1], *sp); }
+			else if (op == UNLK)	{ ax = unlink( (char *)*sp); }
+			else if ( (op == QSRT) || (op == BSRC) ) {
+				// the comparator runs in an eval() of its own on the fuel left, see Callbacks
+				vm[Fuel] = fuel ? ( (fuel > 1) ? fuel - 1 : -1 ) : 0;
+				vm[Cycle] = cycle;
+				i = call_sort(vm, sp, op, &ax);
+				cycle = vm[Cycle];
+				if (fuel) fuel = (vm[Fuel] > 0) ? vm[Fuel] + 1 : 1;
+				if (i) {
+					vm[Pc] = (int)pc; vm[Bp] = (int)bp; vm[Sp] = (int)sp; vm[Ax] = ax; vm[Cycle] = cycle;
+					out_flush(vm);
+					return ax;
+				}
+			}
+			else if (op == HRET)	{
+				// back to the builtin that called vm_call()
+				vm[Pc] = (int)pc; vm[Bp] = (int)bp; vm[Sp] = (int)sp; vm[Ax] = ax; vm[Cycle] = cycle;
+				return ax;
+			}
+
+			// Coroutines
+			// COCR : coro_create(fn, arg)
+			// RSME : resume(co), switch to co
+			// YELD : yield(value), switch back to the context that resumed the coroutine
+			// CRET : fn of the coroutine returned, same as yield but the coroutine is done
+			// CODN : coro_done(co)
+			// COFR : coro_free(co)
+
+			else if (op == COCR)	{ ax = (int)coro_new(vm, sp[1], *sp); }
+			else if (op == RSME)	{
+				t = (int *)*sp;
+				if (t[CoState] == CoSuspended) {
+					cur[Pc] = (int)pc; cur[Bp] = (int)bp; cur[Sp] = (int)sp;
+					t[Caller] = (int)cur;
+					t[CoState] = CoRunning;
+					cur = t;
+					pc = (int *)cur[Pc]; bp = (int *)cur[Bp]; sp = (int *)cur[Sp];
+					ax = 0; // what yield() returns in the coroutine
+				} else if (t[CoState] == CoDone) ax = 0;
+				else {
+					out_flush(vm);
+					printf("ERROR : resume of a running coroutine\n");
+					return -1;
+				}
+			}
+			else if ( (op == YELD) || (op == CRET) ) {
+				if (!cur[Caller]) {
+					out_flush(vm);
+					printf("ERROR : yield outside of a coroutine\n");
+					return -1;
+				}
+				if (op == YELD) {
+					ax = *sp;
+					cur[Pc] = (int)pc; cur[Bp] = (int)bp; cur[Sp] = (int)sp;
+					cur[CoState] = CoSuspended;
+				} else {
+					cur[CoState] = CoDone;
+					coro_release(vm, cur);
+				}
+				t = (int *)cur[Caller];
+				cur[Caller] = 0;
+				cur = t;
+				pc = (int *)cur[Pc]; bp = (int *)cur[Bp]; sp = (int *)cur[Sp];
+			}
+			else if (op == CODN)	{ ax = ((int *)*sp)[CoState] == CoDone; }
+			else if (op == COFR)	{
+				t = (int *)*sp;
+				if (t[CoState] == CoRunning) {
+					printf("ERROR : free of a running coroutine\n");
+					return -1;
+				}
+				coro_release(vm, t);
+				free(t);
+			}
+
+			// Tasks
+			// SPWN : spawn(fn, arg), the first one starts the workers of the pool, see Tasks above
+			// JOIN : join(task), runs other tasks until task is done
+
+			else if (op == SPWN)	{
+				if (!vm[Pool]) pool_start(vm);
+				tmp = task_new( (int *)vm[Pool], sp[1], *sp);
+				if (!dq_push(pool_deque( (int *)vm[Pool], vm[Worker]), tmp)) {
+					// the deque is full, run the task right away
+					c = task_start(vm, tmp);
+					task_finish(tmp, c, eval(c));
+				}
+				ax = (int)tmp;
+			}
+			else if (op == JOIN)	{
+				tmp = (int *)*sp;
+				if ( !vm[Pool] || !is_task( (int *)vm[Pool], tmp) || (tmp[TaskState] == TaskFree) ) {
+					out_flush(vm);
+					printf("ERROR : join of an unknown task\n");
+					return -1;
+				}
+				i = 0;
+				while (tmp[TaskState] != TaskDone) {
+					if ( (t = task_take(vm)) ) {
+						c = task_start(vm, t);
+						task_finish(t, c, eval(c));
+						i = 0;
+					} else task_idle(i++);
+				}
+				ax = tmp[TaskResult];
+				__sync_val_compare_and_swap(tmp + TaskState, TaskDone, TaskFree);
+			}
+
+			// Threads, see above
+			// THCR : pthread_create(&thread, attr, fn, arg)
+			// THJN : pthread_join(thread, &result)
+
+			else if (op == THCR)	{ ax = thread_create(vm, sp); }
+			else if (op == THJN)	{ ax = pthread_join(sp[1], (void *)*sp); }
 			
 			// ERROR fallback
 			// If op doesn't belong to any of the above instructions, there must be something wrong, therefore we exit the VM.
@@ -1494,6 +5668,7 @@ int eval () {
 			//	break;
 			
 			else {
+				out_flush(vm);
 				printf("ERROR : unknown instruction %d\n", op);
 				return -1;
 			}
@@ -1501,44 +5676,82 @@ int eval () {
 	return 0;
 }
 
-int main (int argc, char **argv) {
-	int i, fd;
-	int *tmp;
-
-	DEBUG = 0;
-	ASM = 0;
-
-	argc--;
-	argv++;
-
-	if ( (argc > 0) && (**argv == '-') && ( (*argv)[1] == 's') ) {
-		ASM = 1;
-		--argc;
-		++argv;
-	}
-	
-	if ( (argc > 0) && (**argv == '-') && ( (*argv)[1] == 'd') ) {
-		DEBUG = 1;
-		--argc;
-		++argv;
-	}
-	
-	if (argc < 1) {
-		printf("USAGE : pcc [-s] [-d] file \n");
-		return -1;
-	}
+// Library
+// pcc can be embedded : pcc_compile() turns a source string into a program once, pcc_run() then
+// runs it as many times as needed, each run with a fresh stack and a data segment of its own, a
+// copy of Image, so that runs of the same program can overlap.
+// See pcc.h for the C declarations, and the Program layout at the top of this file.
+
+// Separate compiling
+// prog_compile() compiles n files each in a process of its own, all at the same time, then
+// links them into one program (see Linking), so that compiling takes about as long as the largest
+// file rather than all of them together. The text area, the data segment and the link tables are
+// mmap-ed shared and every file compiles into its own slice of them :
+//
+// +------+------+--     +------+------+--     +------+------+--
+// |file 0|file 1| ..    |file 0|file 1| ..    |file 0|file 1| ..
+// +------+------+--     +------+------+--     +------+------+--
+//  text, poolsize each   data, poolsize each   link tables, poolsize each
+//
+// so that its code and its globals are at their final addresses already. A file knows about the
+// functions and globals of the others through prototypes and extern declarations, usually from a
+// common header. Lazy compilation and profiles go by the symbol table of a single file, they are
+// not available with more than one.
+
+enum {MaxUnits = 64};
+
+void unit_start (int *prog, int k, int n) {
+	// have the compiler emit into the slices of the file k of n in prog
+	text = old_text = (int *)prog[Text] + k * (poolsize / sizeof(int));
+	data = (char *)prog[Data] + k * poolsize;
+	links = (int *)prog[Links] + k * (poolsize / sizeof(int));
+	links[LtNames] = (int)(links + poolsize / sizeof(int));
+	cold_text = text + poolsize / sizeof(int) / 2;
+	str_reset( (int)data );
+	failed = 0;
+}
+
+int unit_compile (int *prog, int k, int n, char *source, char *path) {
+	// compile source as the file k of n into its slices of prog, path : its file name or 0
+	int *half;
+	char *end;
+
+	unit_start(prog, k, n);
+	half = cold_text;
+	end = data + poolsize;
+	if (path) pp_main = path;
 
-	// open file && deal with ERROR msgs
-	if ( (fd = open(*argv, 0)) < 0 ) {
-		printf("ERROR : could not open file %s\n", *argv);
+	line = 1;
+	src = old_src = source;
+	program();
+	if (failed) return -1;
+
+	if (data > end) {
+		printf("ERROR : data segment of %s too large\n", path ? path : "file");
 		return -1;
 	}
-	
-	// default size && init
-	poolsize = 256 * 1024; 
-	line = 1;
+	links[LtText] = (int)( (int *)prog[Text] + k * (poolsize / sizeof(int)) + 1 );
+	links[LtTextEnd] = (int)(text + 1);
+	if (cold_text > half) {
+		links[LtCold] = (int)(half + 1);
+		links[LtColdEnd] = (int)(cold_text + 1);
+	}
+	links[LtData] = (int)data;
+	if ( (idmain[Class] == Fun) && !is_link(idmain[Value]) ) links[LtEntry] = idmain[Value];
+	if (n > 1) link_defs(symbols);
+	return 0;
+}
+
+void pcc_free (int *prog);	// defined below, it also frees a program that pcc_setup() left half done
+
+int *pcc_setup (int n) {
+	// an empty program of n files, with the keywords and the built-in functions in its symbol table
+	int i, flags;
+	int *prog;
+
+	// default size && init, the same for every program, set by the first one
+	if (!poolsize) poolsize = 256 * 1024; 
 
-	// read file finished, ready to do some real stuff
 	// +------------------+
 	// |    stack   |     |      high address
 	// |    ...     v     |
@@ -1559,36 +5772,69 @@ int main (int argc, char **argv) {
 	// Note : currently pcc does not support uninitialised variables, such that there would be no bss segment.
 
 	// allocate memory for VM
-	if ( !(text = old_text = malloc(poolsize)) ) {
-		printf("ERROR : could not malloc size of %d for text area\n", poolsize);
-		return -1;
+	if ( !(prog = malloc(ProgSize * sizeof(int))) ) {
+		printf("ERROR : could not malloc program\n");
+		return 0;
 	}
+	memset(prog, 0, ProgSize * sizeof(int));
+	prog[Units] = n;
+
+	// the compiler starts from empty tables, see Compiler context
+	if ( !(prog[Compiler] = (int)malloc(CcSize * sizeof(int))) ) {
+		printf("ERROR : could not malloc compiler context\n");
+		pcc_free(prog);
+		return 0;
+	}
+	memset( (char *)prog[Compiler], 0, CcSize * sizeof(int) );
+	cc_clear();
+	lazy = LAZY && (n == 1);
+
+	// PROT_READ | PROT_WRITE, MAP_SHARED (0x21) for the compiling processes / MAP_PRIVATE (0x22) | MAP_ANONYMOUS
+	flags = (n > 1) ? 0x21 : 0x22;
+	if ( (text = mmap(0, n * poolsize, 3, flags, -1, 0)) == (int *)-1 ) {
+		printf("ERROR : could not mmap size of %d for text area\n", n * poolsize);
+		pcc_free(prog);
+		return 0;
+	}
+	prog[Text] = (int)text;
 
-	if ( !(data = malloc(poolsize)) ) {
-		printf("ERROR : could not malloc size of %d for data area\n", poolsize);
-		return -1;
+	if ( (data = mmap(0, n * poolsize, 3, flags, -1, 0)) == (char *)-1 ) {
+		printf("ERROR : could not mmap size of %d for data area\n", n * poolsize);
+		pcc_free(prog);
+		return 0;
 	}
+	prog[Data] = (int)data;
 
-	if ( !(stack = malloc(poolsize)) ) {
-		printf("ERROR : could not malloc size of %d for stack area\n", poolsize);
-		return -1;
+	if ( (links = mmap(0, n * poolsize, 3, flags, -1, 0)) == (int *)-1 ) {
+		printf("ERROR : could not mmap size of %d for link tables\n", n * poolsize);
+		pcc_free(prog);
+		return 0;
 	}
-	
+	prog[Links] = (int)links;
+
 	if ( !(symbols = malloc(poolsize)) ) {
 		printf("ERROR : could not malloc size of %d for symbol table\n", poolsize);
-		return -1;
+		pcc_free(prog);
+		return 0;
 	}
+	prog[Symbols] = (int)symbols;
 
-	// init value for VM
-	memset(text, 0, poolsize);
-	memset(data, 0, poolsize);
-	memset(stack, 0, poolsize);
+	// init value for VM, the mmap-ed areas start out 0
 	memset(symbols, 0, poolsize);
 
-	old_text = text;
+	link_lo = (int)links;
+	link_hi = link_lo + n * poolsize;
+	code_at = 1;
+	pp_len = pp_top = 0;
+	failed = 0;
 	
-	src = "char else enum if int return sizeof while "
-	      "open read close printf malloc memset memcmp exit void main";
+	src = "char else enum extern if int return sizeof struct while "
+	      "open read close printf malloc free memset memcmp memcpy mmap munmap fork waitpid _exit fflush sysconf sched_yield usleep "
+	      "__sync_fetch_and_add __sync_val_compare_and_swap spawn join coro_create resume yield coro_done coro_free "
+	      "write fcntl pipe socketpair epoll_create1 epoll_ctl epoll_wait epoll_watch epoll_fds "
+	      "pread pwrite syscall lseek ioq_create ioq_read ioq_write ioq_submit ioq_reap ioq_free "
+	      "snprintf puts putchar out_write socket bind listen accept dup2 unlink qsort bsearch pthread_create pthread_join "
+	      "exit void main";
 
 	// add keywords to symbol table
 	i = Char;
@@ -1608,36 +5854,856 @@ int main (int argc, char **argv) {
 
 	next(); current_id[Token] = Char; // if void, pcc handle it as null char
 	next(); idmain = current_id; // keep track of the main function
-	
-	if ( !(src = old_src = malloc(poolsize)) ) {
-		printf("ERROR : could not malloc size of %d for source area\n", poolsize);
+
+
+	return prog;
+}
+
+int prog_build (int *prog, char **sources, char **paths, int n) {
+	// compile and link the n sources into the empty program prog, returns 0 on an error
+	int i, status, bad, waited;
+	int *t;
+	int pids[MaxUnits];
+
+	links = (int *)prog[Links];
+	if (n == 1) {
+		if (unit_compile(prog, 0, 1, *sources, paths ? *paths : 0) < 0) return 0;
+	} else {
+		// one process per file, see Separate compiling
+		fflush(0);
+		bad = 0;
+		waited = 0;
+		i = 0;
+		while (i < n) {
+			if ( (pids[i] = fork()) < 0 ) {
+				printf("ERROR : could not fork to compile file %d\n", i);
+				return 0;
+			}
+			if (!pids[i]) {
+				status = unit_compile(prog, i, n, sources[i], paths ? paths[i] : 0);
+				fflush(0);
+				_exit(status ? 1 : 0);
+			}
+			i++;
+			// with -s, the listings come out one file after the other
+			while ( (waited < i) && ( ASM || (i == n) ) ) {
+				status = 0;
+				waitpid(pids[waited++], &status, 0);
+				if (status) bad = 1;
+			}
+		}
+		if (bad) return 0;
+	}
+
+	if ( !link_all(links, n) ) return 0;
+
+	prog[Entry] = 0;
+	t = links;
+	i = 0;
+	while (i < n) {
+		if (t[LtEntry]) prog[Entry] = t[LtEntry];
+		t = t + poolsize / sizeof(int);
+		i++;
+	}
+	if (!prog[Entry]) {
+		printf("ERROR : main function not defined\n");
+		return 0;
+	}
+
+	// the last file ends the text segment
+	t = t - poolsize / sizeof(int);
+	text = (int *)t[LtTextEnd] - 1;
+	data = (char *)t[LtData];
+
+	// the functions that never ran, if any, end the text segment
+	if (t[LtCold]) {
+		if (text >= (int *)prog[Text] + poolsize / sizeof(int) / 2) {
+			printf("ERROR : text segment too large to set the cold functions apart\n");
+			return 0;
+		}
+		text = (int *)t[LtColdEnd] - 1;
+	}
+
+	// the runs get a data segment of their own like with a single file
+	if (n > 1) data_private( (char *)prog[Data], data_size(prog));
+
+	// keep the initial data segment for the runs to start from,
+	// with room for the string literals of lazily compiled functions
+	prog[TextEnd] = (int)text;
+	prog[DataEnd] = (int)data;
+	if ( !(prog[Image] = (int)malloc(data_size(prog))) ) {
+		printf("ERROR : could not malloc size of %d for data image\n", data_size(prog));
+		return 0;
+	}
+	data_copy(prog, (char *)prog[Image], (char *)prog[Data]);
+
+	return 1;
+}
+
+int *prog_compile (char **sources, char **paths, int n) {
+	// compile the n sources (0 terminated, they must stay around as long as the program) into one
+	// program, paths : their file names for #include "...", 0 if unknown
+	// returns 0 on an error, after freeing what was built
+	int *prog;
+
+	if ( (n < 1) || (n > MaxUnits) ) {
+		printf("ERROR : can not compile %d files at once\n", n);
+		return 0;
+	}
+	if ( !(prog = pcc_setup(n)) ) return 0;
+	n = prog_build(prog, sources, paths, n);
+
+	// the thread is done with the tables, the program keeps them
+	cc_save(prog);
+	cc_clear();
+	if (!n) {
+		pcc_free(prog);
+		return 0;
+	}
+	return prog;
+}
+
+int *pcc_compile_files (char **sources, char **paths, int n) {
+	// prog_compile() for the library, compile errors return 0 there
+	return prog_compile(sources, paths, n);
+}
+
+int *pcc_compile (char *source) {
+	// compile source (0 terminated, it must stay around as long as the program)
+	return pcc_compile_files(&source, 0, 1);
+}
+
+int *pcc_start (int *prog, int argc, char **argv) {
+	// a job running main(argc, argv) of prog, pcc_step() runs it
+	int *vm;
+	char *seg;
+	int args[2];
+
+	// PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS
+	if ( (seg = mmap(0, data_size(prog), 3, 0x22, -1, 0)) == (char *)-1 ) {
+		printf("ERROR : could not mmap size of %d for data segment\n", data_size(prog));
+		return 0;
+	}
+	data_copy(prog, seg, (char *)prog[Image]);
+
+	args[0] = argc;
+	args[1] = (int)argv;
+	if ( !(vm = vm_create( (int *)prog[Entry], 2, args)) ) {
+		munmap(seg, data_size(prog));
+		return 0;
+	}
+	vm[Prog] = (int)prog;
+	vm[Globals] = (int)seg;
+	return vm;
+}
+
+int pcc_step (int *job, int fuel) {
+	// run job for at most fuel instructions (0 : no limit),
+	// returns 1 if the job is suspended and can be stepped again, 0 once it has exited
+	int i;
+
+	job[Fuel] = fuel;
+	i = eval(job);
+	if (job[Current]) return 1;
+	job[Ax] = i;
+	return 0;
+}
+
+int pcc_end (int *job) {
+	// release job, returns its exit code
+	int i;
+
+	i = job[Ax];
+	if (job[Pool]) pool_stop(job);
+	if (job[Globals]) munmap( (char *)job[Globals], data_size( (int *)job[Prog] ));
+	vm_free(job);
+	return i;
+}
+
+int pcc_run (int *prog, int argc, char **argv) {
+	// run main(argc, argv) of prog, returns its exit code
+	int *job;
+
+	if ( !(job = pcc_start(prog, argc, argv)) ) return -1;
+	pcc_step(job, 0);
+	return pcc_end(job);
+}
+
+void pcc_free (int *prog) {
+	if (prog[Text]) munmap( (char *)prog[Text], prog[Units] * poolsize);
+	if (prog[Data]) munmap( (char *)prog[Data], data_size(prog));
+	if (prog[Links]) munmap( (char *)prog[Links], prog[Units] * poolsize);
+	if (prog[Counts]) munmap( (char *)prog[Counts], poolsize * ProfSize );
+	if (prog[Compiler]) cc_free( (int *)prog[Compiler] );
+	free( (char *)prog[Image] );
+	free( (int *)prog[Symbols] );
+	free(prog);
+}
+
+// Fork server
+// pcc -f file / pcc -u path file : compile once, then run the program once per request in a process
+// forked from the compiled program, so that a run starts without any compiling. A request is a line
+// of arguments, argv[0] being the file name as usual.
+// -f : requests come from stdin and run one after the other
+// -u : requests come from the connections to the Unix socket path and run side by side, the output
+//      of a run and its EXIT line go to its connection, which is also its stdin ; the forked
+//      process reads the request, so a slow client only holds up its own run
+//
+// The server sets up one run before forking, with its stack and its data segment ready, and every
+// forked process runs its own copy-on-write copy of it : nothing is allocated, cleared or copied
+// per run but the frame of main().
+
+enum {MaxLine = 4096, MaxArgs = 64};
+
+int serve_line (int fd, char *buf) {
+	// read a line into buf without reading past it, returns its length or -1 at the end
+	int n, r;
+
+	n = 0;
+	r = 0;
+	while ( (n < MaxLine - 1) && ( (r = read(fd, buf + n, 1)) == 1 ) && (buf[n] != '\n') ) n++;
+	buf[n] = 0;
+	if ( !n && (r != 1) ) return -1;
+	return n;
+}
+
+void serve_run (int *job, char *name, char *line, int conn) {
+	// in the forked process : run job with the arguments in line, read from conn if line is 0
+	char **args;
+	int *prog;
+	int argc, seg;
+	int main_args[2];
+
+	if ( !line && ( !(line = malloc(MaxLine)) || (serve_line(conn, line) < 0) ) ) exit(0);
+	if ( !(args = malloc(MaxArgs * sizeof(char *))) ) exit(-1);
+	args[0] = name;
+	argc = 1;
+	while (*line) {
+		while ( (*line == ' ') || (*line == '\t') || (*line == '\r') ) *line++ = 0;
+		if (*line && (argc < MaxArgs)) args[argc++] = line;
+		while (*line && (*line != ' ') && (*line != '\t') && (*line != '\r')) line++;
+	}
+
+	if (conn >= 0) {
+		dup2(conn, 0);
+		dup2(conn, 1);
+		close(conn);
+	}
+	// main(argc, args) on the stack set up by the server
+	prog = (int *)job[Prog];
+	seg = job[Globals];
+	main_args[0] = argc;
+	main_args[1] = (int)args;
+	vm_setup(job, (int *)job[Stack], poolsize, (int *)prog[Entry], 2, main_args, EXIT);
+	job[Prog] = (int)prog;
+	job[Globals] = seg;
+	pcc_step(job, 0);
+	argc = pcc_end(job);
+	printf("EXIT : %d\n", argc);
+	exit(argc);
+}
+
+int serve_listen (char *path) {
+	// a Unix socket listening on path
+	char addr[110];
+	int fd, n;
+
+	// struct sockaddr_un : |sun_family : 2 bytes|sun_path : 108 bytes|
+	memset(addr, 0, 110);
+	*addr = 1; // AF_UNIX
+	n = 0;
+	while (path[n] && (n < 107)) {
+		addr[n + 2] = path[n];
+		n++;
+	}
+
+	unlink(path);
+	// AF_UNIX, SOCK_STREAM
+	if ( ( (fd = socket(1, 1, 0)) < 0 ) || (bind(fd, (void *)addr, 110) < 0) || (listen(fd, 64) < 0) ) {
+		printf("ERROR : could not listen on %s\n", path);
+		fd = -1;
+	}
+	return fd;
+}
+
+int serve (int *prog, char *name, char *path) {
+	// answer requests until stdin ends / forever
+	char *buf;
+	int *job;
+	int fd, conn, pid;
+
+	if ( !(buf = malloc(MaxLine)) ) return -1;
+	// nothing left for the runs to compile
+	lazy_all(prog);
+	if ( !(job = pcc_start(prog, 0, 0)) ) return -1;
+
+	fd = 0;
+	if (path && ( (fd = serve_listen(path)) < 0 )) return -1;
+	conn = -1;
+	while ( path ? ( (conn = accept(fd, 0, 0)) >= 0 ) : (serve_line(0, buf) >= 0) ) {
+		fflush(0);
+		if ( !(pid = fork()) ) serve_run(job, name, path ? 0 : buf, conn);
+		if (pid < 0) printf("ERROR : could not fork run\n");
+		else if (!path) waitpid(pid, 0, 0);
+		if (path) {
+			close(conn);
+			// reap the runs that are over, WNOHANG
+			while (waitpid(-1, 0, 1) > 0);
+		}
+	}
+	return 0;
+}
+
+// Profile files, see Profile-guided optimization
+
+int prof_start (int *prog) {
+	// count the runs of prog from now on
+	// PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS : the task workers count too
+	if ( (prog[Counts] = (int)mmap(0, poolsize * ProfSize, 3, 0x21, -1, 0)) == -1 ) {
+		printf("ERROR : could not mmap size of %d for profile\n", poolsize * ProfSize);
+		prog[Counts] = 0;
 		return -1;
 	}
+	return 0;
+}
 
-	// read the source file
-	if ( (i = read(fd, src, poolsize - 1)) <= 0) {
-		printf("ERROR : read src failed; return value %d\n", i);
+int prof_save (int *prog, char *path) {
+	// write the counts of prog to path
+	int *pc, *p;
+	int fd, op, len;
+	char *buf;
+
+	// O_WRONLY | O_CREAT | O_TRUNC, 0644
+	if ( (fd = open(path, 577, 420)) < 0 ) {
+		printf("ERROR : could not open profile %s\n", path);
 		return -1;
 	}
-	
-	// add EOF
-	src[i] = 0;
+	if ( !(buf = malloc(OutSize)) ) {
+		printf("ERROR : could not malloc size of %d for profile\n", OutSize);
+		return -1;
+	}
+	len = 0;
+	pc = (int *)prog[Text] + 1;
+	while (pc < (int *)prog[TextEnd]) {
+		op = *pc;
+		if ( (op >= CALL) && (op <= ENT) && (op != STUB) ) {
+			p = (int *)prog[Counts] + (pc - (int *)prog[Text]) * ProfSize;
+			len = len + snprintf(buf + len, TmpSize, "%d %d %d %d\n", pc - (int *)prog[Text], op, p[ProfRuns], p[ProfTaken]);
+			if (len > OutSize - TmpSize) {
+				write(fd, buf, len);
+				len = 0;
+			}
+		}
+		pc = pc + ( (op <= ADJ) ? 2 : 1 );
+	}
+	write(fd, buf, len);
 	close(fd);
+	free(buf);
+	return 0;
+}
 
-	program();
+int prof_num (char **s) {
+	// the number at *s, skipping the blanks before it
+	int n;
 
-	if ( !(pc = (int *)idmain[Value])) {
-		printf("ERROR : main function not defined\n");
+	while ( (**s == ' ') || (**s == '\n') ) *s = *s + 1;
+	n = 0;
+	while ( (**s >= '0') && (**s <= '9') ) {
+		n = n * 10 + **s - '0';
+		*s = *s + 1;
+	}
+	return n;
+}
+
+int prof_load (char *path) {
+	// read the counts in path for the next compile
+	int *p;
+	int fd, size, pass, at;
+	char *buf, *s;
+
+	if ( (fd = open(path, 0)) < 0 ) {
+		printf("ERROR : could not open profile %s\n", path);
+		return -1;
+	}
+	if ( ( (size = lseek(fd, 0, 2)) < 0 ) || !(buf = map_file(fd, size)) ) {
+		printf("ERROR : could not read profile %s\n", path);
 		return -1;
 	}
+	close(fd);
 
-	// setup stack
-	sp = (int *)( (int)stack + poolsize );
-	*--sp = EXIT; // call exit if main returns
-	*--sp = PUSH; tmp = sp;
-	*--sp = argc;
-	*--sp = (int)argv;
-	*--sp = (int)tmp;
+	// the first pass finds the largest offset, the second one fills prof
+	prof_len = 0;
+	pass = 0;
+	while (pass < 2) {
+		if ( pass && !(prof = malloc(prof_len * ProfSize * sizeof(int))) ) {
+			printf("ERROR : could not malloc size of %d for profile\n", prof_len * ProfSize * sizeof(int));
+			return -1;
+		}
+		if (pass) memset(prof, 0, prof_len * ProfSize * sizeof(int));
+		s = buf;
+		while (*s) {
+			at = prof_num(&s);
+			if (!pass) {
+				if (at >= prof_len) prof_len = at + 1;
+				prof_num(&s);
+				prof_num(&s);
+				prof_num(&s);
+			} else {
+				p = prof + at * ProfSize;
+				p[ProfOp] = prof_num(&s) + 1;
+				p[ProfRuns] = prof_num(&s);
+				p[ProfTaken] = prof_num(&s);
+			}
+			while ( (*s == ' ') || (*s == '\n') ) s++;
+		}
+		pass++;
+	}
+	munmap(buf, size + 1);
+	return 0;
+}
+
+// REPL
+// pcc -i [file] reads C from stdin and compiles each declaration or statement as soon as it is
+// complete, after the declarations of file if any. Everything goes to the same text area, data
+// segment and symbol table, so the functions and globals defined so far stay there and can be
+// used by what comes next. Statements are compiled as the body of a function without a name and
+// run right away on a stack kept for the whole session, an expression statement shows its value :
+//
+//    > int sq(int x) { return x * x; }
+//    > sq(7);
+//    = 49
+//
+// An input is complete once its braces are closed and it ends with ';' or '}',
+// a preprocessor line is complete by itself. It is compiled in a forked process first, which tells
+// about a compile error with its exit code, so that an error drops the input without leaving half
+// of it in the symbol table. exit() ends the session.
+//
+// Each input is kept in the source area for the names that point into it, between "(){" and "\n}"
+// that turn a statement into a function for function_declaration().
+//
+// Only the code of the latest input is linked. A statement that uses a symbol not defined yet is
+// dropped. A function that does is put on hold : it is undefined again, with a link record that
+// the calls to it use, even its own ones, until all it needs is defined :
+//
+//	Held function : |Id|Rec|Code|End|	Id : its symbol, Rec : its record, [Code, End) : its code
+//
+// Every input tries the held functions again, together, so that functions that call each other
+// are defined at once.
+
+enum {ReplSize = 65536, MaxHeld = 1024};
+enum {HeldId, HeldRec, HeldCode, HeldEnd, HeldSize};
+
+char *repl_src, *repl_end;	// the input being read in the source area, the end of the area
+int repl_show;			// does the last compiled input show its value
+int repl_exit;			// what the program passed to exit()
+int *repl_held;			// the functions on hold
+int repl_holds;			// how many
+
+int repl_complete (char *s) {
+	// does the input s end a declaration or a statement
+	int depth, q;
+	char *last;
+
+	while ( (*s == ' ') || (*s == '\t') || (*s == '\n') || (*s == '\r') ) s++;
+	if (*s == '#') return 1;
+	depth = 0;
+	last = 0;
+	while (*s) {
+		if ( (*s == '"') || (*s == '\'') ) {
+			q = *s;
+			last = s++;
+			while (*s && (*s != q)) {
+				if ( (*s == '\\') && s[1] ) s++;
+				s++;
+			}
+		} else if ( (*s == '/') && (s[1] == '/') ) {
+			while (s[1] && (s[1] != '\n')) s++;
+		} else {
+			if (*s == '{') depth++;
+			else if (*s == '}') depth--;
+			if (*s > ' ') last = s;
+		}
+		if (*s) s++;
+	}
+	return (depth <= 0) && last && ( (*last == ';') || (*last == '}') );
+}
+
+int *repl_compile (char *input) {
+	// compile the input at input, returns the function of a statement, 0 for declarations
+	int *fn;
+
+	line = 1;
+	src = input;
+	next();
+	if ( (token == Int) || (token == Char) || (token == Struct) || (token == Enum) || (token == Extern) ) {
+		while (token > 0) global_declaration();
+		return 0;
+	}
+	if (token <= 0) return 0;
+	repl_show = (token != If) && (token != While) && (token != Return) && (token != '{') && (token != ';');
+
+	// the statement is the body of a function, see lazy_compile()
+	src = input;
+	while (*src) src++;
+	src[0] = '\n';
+	src[1] = '}';
+	src[2] = 0;
+	pp_len = pp_top = 0;
+	src = input - 2;
+	token = '(';
+	line = 1;
+	fn = text + 1;
+	function_declaration();
+	next();
+	if (token > 0) {
+		fail("ERROR : unexpected } at line %d\n", line, 0);
+		return 0;
+	}
+	return fn;
+}
+
+void repl_hold (int *prog, int *start, int *end) {
+	// put the functions compiled into [start, end) on hold, see above
+	int *id, *f, *r, *h, *pc;
+	int i, op;
+
+	id = (int *)prog[Symbols];
+	while (id[Token]) {
+		if ( (id[Class] == Fun) && !is_link(id[Value]) && ( (int *)id[Value] >= start ) && ( (int *)id[Value] < end ) ) {
+			// its code ends where the next function of the input starts
+			h = end;
+			f = (int *)prog[Symbols];
+			while (f[Token]) {
+				if ( (f[Class] == Fun) && (f[Value] > id[Value]) && ( (int *)f[Value] < h ) ) h = (int *)f[Value];
+				f = f + IdSize;
+			}
+
+			// the record of an earlier declaration or call, else a new one
+			r = 0;
+			f = (int *)prog[Links] + LtHead;
+			i = ( (int *)prog[Links] )[LtLen];
+			while (i--) {
+				if (f[LnkAddr] == id[Value]) r = f;
+				f = f + LnkSize;
+			}
+			if (!r) r = (int *)link_ref(id);
+			r[LnkAddr] = 0;
+
+			// the calls the input makes to it go through the record
+			pc = start;
+			while (pc < end) {
+				op = *pc++;
+				if (op <= ADJ) {
+					if ( (op == CALL) && (*pc == id[Value]) ) *pc = (int)r;
+					pc++;
+				}
+			}
+
+			// a function defined again replaces its earlier version on hold
+			i = 0;
+			while ( (i < repl_holds) && (repl_held[i * HeldSize + HeldId] != (int)id) ) i++;
+			if ( (i == repl_holds) && (repl_holds < MaxHeld) ) repl_holds++;
+			if (i < repl_holds) {
+				f = repl_held + i * HeldSize;
+				f[HeldId] = (int)id;
+				f[HeldRec] = (int)r;
+				f[HeldCode] = id[Value];
+				f[HeldEnd] = (int)h;
+			} else printf("ERROR : too many functions waiting for their symbols\n");
+			id[Value] = (int)r;
+		}
+		id = id + IdSize;
+	}
+}
+
+void repl_link () {
+	// define the functions on hold whose symbols are all defined, taking those on hold as defined
+	int *f, *r;
+	int i, more;
+
+	i = 0;
+	while (i < repl_holds) {
+		f = repl_held + i * HeldSize;
+		( (int *)f[HeldRec] )[LnkAddr] = f[HeldCode];
+		i++;
+	}
+
+	// drop the ones that use a symbol still unknown, until none does
+	more = 1;
+	while (more) {
+		more = 0;
+		i = 0;
+		while (i < repl_holds) {
+			f = repl_held + i * HeldSize;
+			r = (int *)f[HeldRec];
+			if ( r[LnkAddr] && link_unknown( (int *)f[HeldCode], (int *)f[HeldEnd] ) ) {
+				r[LnkAddr] = 0;
+				more = 1;
+			}
+			i++;
+		}
+	}
+
+	// the others are defined and leave the list
+	i = 0;
+	while (i < repl_holds) {
+		f = repl_held + i * HeldSize;
+		if ( ( (int *)f[HeldRec] )[LnkAddr] ) {
+			link_code( (int *)f[HeldCode], (int *)f[HeldEnd] );
+			( (int *)f[HeldId] )[Value] = f[HeldCode];
+			memcpy(f, repl_held + --repl_holds * HeldSize, HeldSize * sizeof(int));
+		} else i++;
+	}
+}
+
+int repl_run (int *prog, int *vm, int *fn) {
+	// link and run the statement compiled at fn, returns 0 once the program has called exit()
+	int i;
+
+	// a statement that can not run is dropped
+	repl_link();
+	if ( !link_code(fn, text + 1) ) {
+		text = fn - 1;
+		return 1;
+	}
+	prog[TextEnd] = (int)text;
+	prog[DataEnd] = (int)data;
+	prog[Entry] = (int)fn;
+
+	fflush(0);
+	vm_setup(vm, (int *)vm[Stack], poolsize, fn, 0, 0, EXIT);
+	vm[Prog] = (int)prog;
+	i = eval(vm);
+	if (vm[Pool]) pool_stop(vm);
+	if (vm[Coros]) munmap( (char *)vm[Coros], CoroArea * sizeof(int) + MaxCoros * CoroStack);
+
+	// returning from fn ends on the EXIT at the top of the stack, exit() on one of its own
+	if (vm[Pc] != vm[Stack] + poolsize) {
+		repl_exit = i;
+		return 0;
+	}
+	if (repl_show) printf("= %d\n", i);
+	return 1;
+}
+
+char *repl_area (int size) {
+	// a new source area of at least size bytes
+	if (size < ReplSize) size = ReplSize;
+	if ( !(repl_src = malloc(size)) ) {
+		printf("ERROR : could not malloc size of %d for source area\n", size);
+		exit(-1);
+	}
+	repl_end = repl_src + size;
+	return repl_src;
+}
+
+int repl (char *source, char *path) {
+	// pcc -i [file] : the REPL, source / path : the file, 0 if none, returns the exit code
+	int *prog, *vm, *fn, *start;
+	int n, len, pid, status;
+	char *input, *buf;
+
+	if ( !(prog = pcc_setup(1)) ) return -1;
+	unit_start(prog, 0, 1);
+	lazy = 0;
+	ASM = 0;
+	if ( !(repl_held = malloc(MaxHeld * HeldSize * sizeof(int))) ) return -1;
+	repl_holds = 0;
+	if (source) {
+		pp_main = path;
+		line = 1;
+		src = old_src = source;
+		program();
+		if (failed) return -1;
+		repl_hold(prog, (int *)prog[Text] + 1, text + 1);
+	}
+	if ( !(vm = vm_create( (int *)prog[Text], 0, 0)) || !(buf = malloc(MaxLine)) ) return -1;
+
+	repl_area(ReplSize);
+	input = 0;
+	len = 0;
+	while (1) {
+		printf(input ? ". " : "> ");
+		fflush(0);
+		if ( (n = serve_line(0, buf)) < 0 ) {
+			printf("\n");
+			return 0;
+		}
+
+		// add the line to the input, the input goes to a new source area if it does not fit
+		if ( (input ? input + len : repl_src + 3) + n + 4 > repl_end ) {
+			repl_area(len + n + 8);
+			if (input) memcpy(repl_src + 3, input, len);
+			input = 0;
+		}
+		if (!input) {
+			memcpy(repl_src, "(){", 3);
+			input = repl_src + 3;
+		}
+		memcpy(input + len, buf, n);
+		len = len + n;
+		input[len++] = '\n';
+		input[len] = 0;
+
+		if (repl_complete(input)) {
+			// compile it in a process of its own first, to find the errors
+			fflush(0);
+			status = 0;
+			if ( !(pid = fork()) ) {
+				repl_compile(input);
+				fflush(0);
+				_exit(failed);
+			}
+			if (pid > 0) waitpid(pid, &status, 0);
+			if ( (pid > 0) && !status ) {
+				start = text + 1;
+				fn = repl_compile(input);
+				repl_src = input + len + 3;
+				if (!fn) repl_hold(prog, start, text + 1);
+				if ( fn && !repl_run(prog, vm, fn) ) return repl_exit;
+			}
+			input = 0;
+			len = 0;
+		}
+	}
+	return 0;
+}
+
+int main (int argc, char **argv) {
+	int i, fd, size, server, count, units, interactive;
+	int *prog;
+	char *source, *path, *profile;
+	char *sources[MaxUnits];
+	int sizes[MaxUnits];
+
+	DEBUG = 0;
+	ASM = 0;
+	LAZY = 0;
+	OPT = 0;
+
+	argc--;
+	argv++;
+
+	if ( (argc > 0) && (**argv == '-') && ( (*argv)[1] == 's') ) {
+		ASM = 1;
+		--argc;
+		++argv;
+	}
+	
+	if ( (argc > 0) && (**argv == '-') && ( (*argv)[1] == 'd') ) {
+		DEBUG = 1;
+		--argc;
+		++argv;
+	}
+
+	if ( (argc > 0) && (**argv == '-') && ( (*argv)[1] == 'l') ) {
+		LAZY = 1;
+		--argc;
+		++argv;
+	}
+
+	if ( (argc > 0) && (**argv == '-') && ( (*argv)[1] == 'O') ) {
+		OPT = (*argv)[2] ? (*argv)[2] - '0' : 1;
+		if ( (OPT < 0) || (OPT > 3) || ( (*argv)[2] && (*argv)[3] ) ) {
+			printf("ERROR : unknown optimization level %s, use -O0 to -O3\n", *argv);
+			return -1;
+		}
+		--argc;
+		++argv;
+	}
+
+	// -p file : count while running into file, -P file : compile with the counts in file
+	count = 0;
+	profile = 0;
+	if ( (argc > 1) && (**argv == '-') && ( ( (*argv)[1] == 'p') || ( (*argv)[1] == 'P') ) ) {
+		count = (*argv)[1] == 'p';
+		profile = argv[1];
+		argc = argc - 2;
+		argv = argv + 2;
+		LAZY = 0;
+		if (count) OPT = 0;
+		else {
+			if (!OPT) OPT = 1;
+			if (prof_load(profile) < 0) return -1;
+		}
+	}
+
+	server = 0;
+	path = 0;
+	if ( (argc > 0) && (**argv == '-') && ( (*argv)[1] == 'f') ) {
+		server = 1;
+		--argc;
+		++argv;
+	} else if ( (argc > 1) && (**argv == '-') && ( (*argv)[1] == 'u') ) {
+		server = 1;
+		path = argv[1];
+		argc = argc - 2;
+		argv = argv + 2;
+	}
+	
+	// -m n : the n files that follow make one program, see Separate compiling
+	units = 1;
+	if ( (argc > 1) && (**argv == '-') && ( (*argv)[1] == 'm') ) {
+		units = 0;
+		source = argv[1];
+		while ( (*source >= '0') && (*source <= '9') ) units = units * 10 + *source++ - '0';
+		argc = argc - 2;
+		argv = argv + 2;
+		if ( (units > 1) && (count || profile) ) {
+			printf("ERROR : profiles are for a single file\n");
+			return -1;
+		}
+	}
+	
+	// -i : the REPL, the file is optional
+	interactive = 0;
+	if ( (argc > 0) && (**argv == '-') && ( (*argv)[1] == 'i') && (units == 1) ) {
+		interactive = 1;
+		--argc;
+		++argv;
+		if (!argc) units = 0;
+	}
+	
+	if ( (argc < units) || (units < !interactive) || (units > MaxUnits) ) {
+		printf("USAGE : pcc [-s] [-d] [-l] [-O[level]] [-p file | -P file] [-f | -u path] [-m n file...] [-i] file \n");
+		return -1;
+	}
+
+	i = 0;
+	while (i < units) {
+		// open file && deal with ERROR msgs
+		if ( (fd = open(argv[i], 0)) < 0 ) {
+			printf("ERROR : could not open file %s\n", argv[i]);
+			return -1;
+		}
+		
+		// map the source file, the 0 after it is the EOF
+		if ( (size = lseek(fd, 0, 2)) <= 0 ) {
+			printf("ERROR : read src failed; return value %d\n", size);
+			return -1;
+		}
+
+		if ( !(sources[i] = map_file(fd, size)) ) {
+			printf("ERROR : could not mmap size of %d for source area\n", size);
+			return -1;
+		}
+		sizes[i++] = size;
+		close(fd);
+	}
 
-	return eval();
+	if (interactive) return repl(units ? *sources : 0, *argv);
+	if ( !(prog = prog_compile(sources, argv, units)) ) return -1;
+	if ( count && (prof_start(prog) < 0) ) return -1;
+
+	// the program sees the first file as its name and the arguments after the last one
+	argv[units - 1] = *argv;
+	argc = argc - units + 1;
+	argv = argv + units - 1;
+	if (server) return serve(prog, *argv, path);
+
+	i = pcc_run(prog, argc, argv);
+	if (count) prof_save(prog, profile);
+	while (units--) munmap(sources[units], sizes[units] + 1);
+	printf("EXIT : %d\n", i);
+	return i;
 }
@@ -0,0 +1,68 @@
+#ifndef PCC_H
+#define PCC_H
+
+// pcc as a library
+//
+// Link with libpcc.a / libpcc.so (see Makefile). Like pcc itself, the library assumes that an int
+// can hold a pointer, so hosts have to be built with -m32 on 64-bit machines.
+//
+//	int *prog = pcc_compile(source);	// parse and compile once
+//	pcc_run(prog, argc, argv);		// run as many times as needed
+//	pcc_free(prog);
+//
+// Each run starts with a fresh stack and a data segment of its own, a copy of the one compiled, so
+// runs of the same program may overlap and do not see each other's globals. Runs may happen on
+// different threads, and so may compiles : the compiler state belongs to the thread compiling and
+// to the program compiled. Only the options below are shared, set them before compiling.
+// A program that calls spawn() or pthread_create() runs on threads of its own in the host process,
+// link the host with -pthread.
+
+// compile a 0 terminated source string that stays valid as long as the program, returns 0 on failure
+// after printing the first error and freeing what was built, the host goes on. With LAZY, a function
+// with an error stops the run that calls it with -1.
+int *pcc_compile (char *source);
+
+// compile n sources into one program, each in a process of its own at the same time, then link them,
+// paths : their file names for #include "...", 0 if unknown, returns 0 on failure like pcc_compile().
+// LAZY does not apply to more than one.
+int *pcc_compile_files (char **sources, char **paths, int n);
+
+// run main(argc, argv) of a compiled program, returns its exit code
+int pcc_run (int *prog, int argc, char **argv);
+
+// Jobs : time-sliced runs
+//
+//	int *job = pcc_start(prog, argc, argv);
+//	while (pcc_step(job, 10000)) ...;	// run 10000 instructions at a time, e.g. round robin
+//	code = pcc_end(job);
+//
+// A suspended job keeps its whole VM state and goes on exactly where it stopped. Every job has
+// globals of its own, so jobs of the same program can be interleaved like jobs of different ones.
+
+// a job running main(argc, argv) of a compiled program, 0 on failure
+int *pcc_start (int *prog, int argc, char **argv);
+
+// run a job for at most fuel instructions (0 : no limit), returns 1 while it is suspended, 0 once it has exited
+int pcc_step (int *job, int fuel);
+
+// release a job, returns its exit code
+int pcc_end (int *job);
+
+// release a compiled program
+void pcc_free (int *prog);
+
+// the pcc command line, main() of pcc.c
+int pcc_main (int argc, char **argv);
+
+// output ASM code / DEBUG information like pcc -s / pcc -d
+extern int ASM;
+extern int DEBUG;
+
+// compile functions on their first call like pcc -l, the compiling then happens during runs :
+// runs of the same program on several threads take turns to compile
+extern int LAZY;
+
+// optimization level like pcc -O<level>, 0 : none
+extern int OPT;
+
+#endif